@@ -0,0 +1,92 @@
+/**
+ * @file cancellation.cpp
+ * @brief 协作式取消实现
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ */
+#include "cancellation.h"
+#include <chrono>
+
+namespace sylar {
+
+CancellationToken::ptr CancellationToken::Create(uint64_t timeout_ms) {
+    return std::make_shared<CancellationToken>(timeout_ms ? NowMs() + timeout_ms : 0);
+}
+
+uint64_t CancellationToken::NowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+CancellationToken::~CancellationToken() {
+    if(m_parent) {
+        m_parent->removeCallback(m_parentCallback);
+    }
+}
+
+CancellationToken::ptr CancellationToken::createChild(uint64_t timeout_ms) {
+    uint64_t deadline = timeout_ms ? NowMs() + timeout_ms : 0;
+    if(m_deadline && (!deadline || m_deadline < deadline)) {
+        deadline = m_deadline;
+    }
+    ptr child = std::make_shared<CancellationToken>(deadline);
+    // 父令牌只持有子令牌的弱引用，子令牌析构时删除回调
+    std::weak_ptr<CancellationToken> weak = child;
+    uint64_t id = addCallback([weak]() {
+        ptr c = weak.lock();
+        if(c) {
+            c->cancel();
+        }
+    });
+    if(id == 0) {
+        child->cancel();
+    } else {
+        child->m_parent = shared_from_this();
+        child->m_parentCallback = id;
+    }
+    return child;
+}
+
+void CancellationToken::cancel() {
+    std::vector<std::pair<uint64_t, Callback> > callbacks;
+    {
+        Spinlock::Lock lock(m_lock);
+        if(m_cancelled.exchange(true, std::memory_order_acq_rel)) {
+            return;
+        }
+        callbacks.swap(m_callbacks);
+    }
+    // 回调中可能加锁、唤醒协程，不能持有 m_lock
+    for(auto& i : callbacks) {
+        i.second();
+    }
+}
+
+uint64_t CancellationToken::addCallback(Callback cb) {
+    Spinlock::Lock lock(m_lock);
+    if(m_cancelled.load(std::memory_order_relaxed)) {
+        return 0;
+    }
+    uint64_t id = m_nextId++;
+    m_callbacks.emplace_back(id, std::move(cb));
+    return id;
+}
+
+bool CancellationToken::removeCallback(uint64_t id) {
+    Callback cb;
+    {
+        Spinlock::Lock lock(m_lock);
+        for(auto it = m_callbacks.begin(); it != m_callbacks.end(); ++it) {
+            if(it->first == id) {
+                // 在锁外析构，回调捕获的对象析构时可能再访问本令牌
+                cb = std::move(it->second);
+                m_callbacks.erase(it);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+}
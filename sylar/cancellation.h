@@ -0,0 +1,117 @@
+/**
+ * @file cancellation.h
+ * @brief 协作式取消：取消令牌与截止时间
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * 上游请求超时或放弃后，为它工作的协程应尽快停下，而不是继续跑完浪费 CPU。
+ * 1、令牌挂在 Fiber 上（Fiber::setCancellationToken）。回调任务不自动继承调度者的令牌，
+ *    需要时显式传给 Scheduler::schedule / scheduleWithResult，已取消的回调任务不再执行
+ * 2、检查点：YieldToReady / YieldTo 切回后、Channel 收发、Future 等待、FiberCondition 等待，
+ *    发现已取消时抛出 CancelledError；协程入口把它当作正常结束，不打错误日志
+ * 3、cancel() 会唤醒挂起在上述等待中的协程；FiberMutex、FiberSemaphore 的等待不可取消
+ * 4、截止时间只在检查点判断：没有定时器，挂起中的等待不会因为超时被唤醒，需要时由上游调用 cancel()
+ * 5、子令牌在父令牌取消时一起取消，截止时间取两者中较早的
+ */
+#ifndef __SYLAR_CANCELLATION_H__
+#define __SYLAR_CANCELLATION_H__
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include "mutex.h"
+#include "unique_function.h"
+
+namespace sylar {
+
+/**
+ * @brief 检查点发现已取消时抛出
+ */
+class CancelledError : public std::runtime_error {
+public:
+    CancelledError(const std::string& what = "operation cancelled")
+        :std::runtime_error(what) {
+    }
+};
+
+/**
+ * @brief 取消令牌，线程安全
+ */
+class CancellationToken : public std::enable_shared_from_this<CancellationToken> {
+public:
+    typedef std::shared_ptr<CancellationToken> ptr;
+    typedef UniqueFunction<void()> Callback;
+
+    /**
+     * @brief 创建令牌
+     * @param[in] timeout_ms 从现在起的超时时间，0 表示没有截止时间
+     */
+    static ptr Create(uint64_t timeout_ms = 0);
+
+    /**
+     * @brief 当前单调时钟，毫秒
+     */
+    static uint64_t NowMs();
+
+    CancellationToken(uint64_t deadline_ms = 0)
+        :m_deadline(deadline_ms) {
+    }
+    ~CancellationToken();
+    CancellationToken(const CancellationToken&) = delete;
+    CancellationToken& operator=(const CancellationToken&) = delete;
+
+    /**
+     * @brief 创建子令牌：本令牌取消时子令牌也取消
+     * @param[in] timeout_ms 子令牌自己的超时时间，截止时间取与本令牌中较早的，0 表示沿用本令牌的
+     */
+    ptr createChild(uint64_t timeout_ms = 0);
+
+    /**
+     * @brief 取消，执行所有回调。重复调用无影响
+     */
+    void cancel();
+
+    /**
+     * @brief 是否已取消或已过截止时间
+     */
+    bool isCancelled() const {
+        if(m_cancelled.load(std::memory_order_acquire)) {
+            return true;
+        }
+        return m_deadline && NowMs() >= m_deadline;
+    }
+
+    /**
+     * @brief 截止时间（NowMs 的时间），0 表示没有
+     */
+    uint64_t getDeadline() const { return m_deadline;}
+
+    /**
+     * @brief 注册取消回调，在调用 cancel() 的执行流上执行
+     * @return 回调的 id；已经取消时不注册、不执行，返回0
+     */
+    uint64_t addCallback(Callback cb);
+
+    /**
+     * @brief 删除回调
+     * @return 回调已经执行（或正在执行）返回false
+     */
+    bool removeCallback(uint64_t id);
+private:
+    std::atomic<bool> m_cancelled{false};
+    uint64_t m_deadline = 0;
+    Spinlock m_lock;
+    uint64_t m_nextId = 1;
+    std::vector<std::pair<uint64_t, Callback> > m_callbacks;
+    // 子令牌在父令牌上注册的回调，析构时删除
+    ptr m_parent;
+    uint64_t m_parentCallback = 0;
+};
+
+}
+
+#endif
@@ -0,0 +1,171 @@
+/**
+ * @file channel.cpp
+ * @brief 协程通道实现
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ */
+#include "channel.h"
+#include "log.h"
+#include <algorithm>
+
+namespace sylar {
+
+void ChannelBase::close() {
+    if(m_closed.exchange(true, std::memory_order_acq_rel)) {
+        return;
+    }
+    // 置位后再取等待队列：还没入队的等待者在 m_lock 内会看到关闭标记
+    std::vector<FiberWaitQueue::Waiter> waiters;
+    {
+        Spinlock::Lock lock(m_lock);
+        FiberWaitQueue::Waiter waiter;
+        while(m_recvWaiters.pop(waiter)) {
+            waiters.push_back(std::move(waiter));
+        }
+        while(m_sendWaiters.pop(waiter)) {
+            waiters.push_back(std::move(waiter));
+        }
+        m_recvWaiting.store(0, std::memory_order_relaxed);
+        m_sendWaiting.store(0, std::memory_order_relaxed);
+    }
+    for(auto& i : waiters) {
+        FiberWaitQueue::Wake(i);
+    }
+}
+
+void ChannelBase::wakeOne(FiberWaitQueue& queue, std::atomic<uint32_t>& waiting) {
+    FiberWaitQueue::Waiter waiter;
+    {
+        Spinlock::Lock lock(m_lock);
+        bool found = queue.pop(waiter);
+        // pop 可能顺带丢掉了 select 留下的作废副本，直接以队列长度为准
+        waiting.store(queue.size(), std::memory_order_relaxed);
+        if(!found) {
+            return;
+        }
+    }
+    FiberWaitQueue::Wake(waiter);
+}
+
+void ChannelBase::interrupted(FiberWaitQueue& queue, std::atomic<uint32_t>& waiting) {
+    {
+        // 离开时登记数没有被唤醒者撤销
+        Spinlock::Lock lock(m_lock);
+        waiting.store(queue.size(), std::memory_order_relaxed);
+    }
+    throw CancelledError();
+}
+
+int ChannelSelect::tryAll(int first) {
+    size_t n = m_cases.size();
+    bool all_closed = true;
+    for(size_t k = 0; k <= n; ++k) {
+        int i = first;
+        if(k > 0) {
+            i = (m_start + k - 1) % n;
+            if(i == first) {
+                continue;
+            }
+        } else if(first < 0) {
+            continue;
+        }
+        int rt = m_cases[i]->tryOp();
+        if(rt == READY) {
+            return i;
+        }
+        if(rt != CLOSED) {
+            all_closed = false;
+        }
+    }
+    return all_closed ? -2 : -1;
+}
+
+void ChannelSelect::complete(int idx, int woken) {
+    m_cases[idx]->complete();
+    if(woken < 0 || &m_cases[woken]->queue() == &m_cases[idx]->queue()) {
+        return;
+    }
+    Case* c = m_cases[woken].get();
+    if(c->isSend) {
+        c->channel->notifySendWaiter();
+    } else {
+        c->channel->notifyRecvWaiter();
+    }
+}
+
+int ChannelSelect::select(bool block) {
+    SYLAR_ASSERT(!m_cases.empty());
+    ++m_start;
+    // 上一次唤醒本 select 的分支，优先尝试它
+    int woken = -1;
+    while(true) {
+        int idx = tryAll(woken);
+        if(idx >= 0) {
+            complete(idx, woken);
+            return idx;
+        }
+        if(idx == -2 || !block) {
+            return -1;
+        }
+        Fiber::CheckCancel();
+
+        // 按地址顺序对所有通道加锁，多个 select 之间不会死锁
+        std::vector<ChannelBase*> channels;
+        for(auto& i : m_cases) {
+            channels.push_back(i->channel);
+        }
+        std::sort(channels.begin(), channels.end());
+        channels.erase(std::unique(channels.begin(), channels.end()), channels.end());
+        std::vector<Spinlock*> locks;
+        for(auto i : channels) {
+            i->m_lock.lock();
+            locks.push_back(&i->m_lock);
+        }
+
+        // 在每个分支上登记后再检查一次，与单个通道的收发相同
+        for(auto& i : m_cases) {
+            ChannelBase::Register(i->waiting());
+        }
+        idx = tryAll(woken);
+        if(idx >= 0 || idx == -2) {
+            for(auto& i : m_cases) {
+                ChannelBase::Unregister(i->waiting());
+            }
+            for(auto i : locks) {
+                i->unlock();
+            }
+            if(idx == -2) {
+                return -1;
+            }
+            complete(idx, woken);
+            return idx;
+        }
+
+        std::vector<FiberWaitQueue*> queues;
+        for(auto& i : m_cases) {
+            queues.push_back(&i->queue());
+        }
+        FiberWaitQueue::Token token = std::make_shared<std::atomic<bool> >(false);
+        FiberWaitQueue* woken_queue = nullptr;
+        FiberWaitQueue::WaitMany(queues, locks, token, &woken_queue);
+        woken = -1;
+        for(size_t i = 0; i < m_cases.size(); ++i) {
+            if(&m_cases[i]->queue() == woken_queue) {
+                woken = i;
+                break;
+            }
+        }
+
+        // 被某个通道唤醒（或通道关闭），清掉其他队列中作废的副本后重新尝试
+        for(auto i : channels) {
+            Spinlock::Lock lock(i->m_lock);
+            i->m_recvWaiters.remove(token);
+            i->m_sendWaiters.remove(token);
+            i->m_recvWaiting.store(i->m_recvWaiters.size(), std::memory_order_relaxed);
+            i->m_sendWaiting.store(i->m_sendWaiters.size(), std::memory_order_relaxed);
+        }
+    }
+}
+
+}
@@ -0,0 +1,551 @@
+/**
+ * @file channel.h
+ * @brief 协程通道：有界/无界 MPMC 队列，满/空时挂起协程
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * 用于在调度器上搭建多级流水线：各级协程之间通过 Channel 传递数据，满/空时只挂起当前协程，
+ * 不阻塞调度线程，也不需要把数据交给别的线程。
+ *
+ * 1、有界通道的数据通路是无锁的 MPMC 环形队列（Dmitry Vyukov 的有界队列），容量向上取整为2的幂（至少为2）；
+ *    无界通道（capacity 为0）用 Spinlock 保护的 deque，发送永远不会挂起
+ * 2、只有在满/空需要等待时才进入 m_lock 保护的等待队列。快速路径上收发数据之后只多一次
+ *    内存屏障和一次原子读，用来判断对端是否有等待者
+ * 3、close 后不能再发送；已在通道中的数据仍可以接收，取完后 recv 返回false
+ * 4、等待者与 fiber_mutex.h 中的原语一样：调度器子协程挂起协程，其他执行流阻塞线程
+ * 5、ChannelSelect 同时等待多个通道上的收/发，任意一个就绪即执行对应分支
+ * 6、send/recv 挂起时可以被协程的取消令牌打断，见 cancellation.h
+ */
+#ifndef __SYLAR_CHANNEL_H__
+#define __SYLAR_CHANNEL_H__
+
+#include <stdint.h>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+#include "fiber_mutex.h"
+#include "mutex.h"
+#include "macor.h"
+
+namespace sylar {
+
+/**
+ * @brief 有界无锁 MPMC 环形队列
+ * 每个槽位有一个序号：等于入队位置时可写，等于入队位置+1时可读，读完后加上容量留给下一轮写入
+ */
+template<class T>
+class MpmcRingQueue {
+public:
+    explicit MpmcRingQueue(size_t capacity) {
+        // 只有一个槽位时"可读"的序号与下一轮"可写"的序号相同，至少要两个
+        size_t size = 2;
+        while(size < capacity) {
+            size <<= 1;
+        }
+        m_mask = size - 1;
+        m_cells = new Cell[size];
+        for(size_t i = 0; i < size; ++i) {
+            m_cells[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    ~MpmcRingQueue() {
+        T v;
+        while(tryPop(v)) {
+        }
+        delete[] m_cells;
+    }
+
+    MpmcRingQueue(const MpmcRingQueue&) = delete;
+    MpmcRingQueue& operator=(const MpmcRingQueue&) = delete;
+
+    /**
+     * @brief 入队，队列满返回false，此时 v 不会被移动
+     */
+    template<class U>
+    bool tryPush(U&& v) {
+        Cell* cell;
+        size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+        while(true) {
+            cell = &m_cells[pos & m_mask];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if(diff == 0) {
+                if(m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if(diff < 0) {
+                // 这个槽位上一轮的数据还没被取走
+                return false;
+            } else {
+                pos = m_enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+        ::new ((void*)cell->storage) T(std::forward<U>(v));
+        cell->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief 出队，队列空返回false
+     * 已占位但还没写完的槽位也视为空
+     */
+    bool tryPop(T& v) {
+        Cell* cell;
+        size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+        while(true) {
+            cell = &m_cells[pos & m_mask];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if(diff == 0) {
+                if(m_dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if(diff < 0) {
+                return false;
+            } else {
+                pos = m_dequeuePos.load(std::memory_order_relaxed);
+            }
+        }
+        T* p = std::launder(reinterpret_cast<T*>(cell->storage));
+        v = std::move(*p);
+        p->~T();
+        cell->seq.store(pos + m_mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t capacity() const { return m_mask + 1;}
+
+    /**
+     * @brief 近似的元素个数，并发时只作参考
+     */
+    size_t size() const {
+        size_t enq = m_enqueuePos.load(std::memory_order_relaxed);
+        size_t deq = m_dequeuePos.load(std::memory_order_relaxed);
+        return enq > deq ? enq - deq : 0;
+    }
+private:
+    struct Cell {
+        std::atomic<size_t> seq;
+        alignas(T) unsigned char storage[sizeof(T)];
+    };
+    Cell* m_cells;
+    size_t m_mask;
+    // 生产者和消费者各自的位置放在不同的缓存行，避免伪共享
+    alignas(64) std::atomic<size_t> m_enqueuePos{0};
+    alignas(64) std::atomic<size_t> m_dequeuePos{0};
+};
+
+class ChannelSelect;
+
+/**
+ * @brief 通道中与元素类型无关的部分：关闭状态和收发两侧的等待队列
+ */
+class ChannelBase {
+friend class ChannelSelect;
+public:
+    ChannelBase(const ChannelBase&) = delete;
+    ChannelBase& operator=(const ChannelBase&) = delete;
+
+    /**
+     * @brief 关闭通道，唤醒所有等待者。重复关闭无影响
+     */
+    void close();
+
+    bool isClosed() const { return m_closed.load(std::memory_order_acquire);}
+protected:
+    ChannelBase() = default;
+    ~ChannelBase() = default;
+
+    /**
+     * @brief 放入数据后调用，有接收者在等待时唤醒一个
+     */
+    void notifyRecvWaiter() {
+        // 与等待者的 "登记等待数 -> 再检查一次数据" 配对，二者至少有一方能看到对方
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(SYLAR_UNLIKELY(m_recvWaiting.load(std::memory_order_relaxed) != 0)) {
+            wakeOne(m_recvWaiters, m_recvWaiting);
+        }
+    }
+
+    /**
+     * @brief 取出数据后调用，有发送者在等待时唤醒一个
+     */
+    void notifySendWaiter() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(SYLAR_UNLIKELY(m_sendWaiting.load(std::memory_order_relaxed) != 0)) {
+            wakeOne(m_sendWaiters, m_sendWaiting);
+        }
+    }
+
+    /**
+     * @brief 登记等待，调用时必须持有 m_lock
+     * 登记后调用者要再检查一次数据，检查失败才能调用 FiberWaitQueue::wait
+     */
+    static void Register(std::atomic<uint32_t>& waiting) {
+        waiting.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    /**
+     * @brief 撤销登记，调用时必须持有 m_lock
+     */
+    static void Unregister(std::atomic<uint32_t>& waiting) {
+        waiting.fetch_sub(1, std::memory_order_relaxed);
+    }
+    /**
+     * @brief 等待被取消：修正等待数后抛出 CancelledError
+     */
+    void interrupted(FiberWaitQueue& queue, std::atomic<uint32_t>& waiting);
+private:
+    void wakeOne(FiberWaitQueue& queue, std::atomic<uint32_t>& waiting);
+protected:
+    Spinlock m_lock;
+    FiberWaitQueue m_recvWaiters;
+    FiberWaitQueue m_sendWaiters;
+    // 等待队列的长度，让快速路径不加锁就能判断有没有等待者。
+    // 在 m_lock 内修改，释放 m_lock 时与队列长度一致
+    std::atomic<uint32_t> m_recvWaiting{0};
+    std::atomic<uint32_t> m_sendWaiting{0};
+    std::atomic<bool> m_closed{false};
+};
+
+/**
+ * @brief 协程通道
+ * T 需要可默认构造和移动赋值
+ */
+template<class T>
+class Channel : public ChannelBase {
+friend class ChannelSelect;
+public:
+    typedef std::shared_ptr<Channel> ptr;
+
+    /**
+     * @brief 构造函数
+     * @param[in] capacity 容量，0 表示无界
+     */
+    explicit Channel(size_t capacity = 0) {
+        if(capacity) {
+            m_ring.reset(new MpmcRingQueue<T>(capacity));
+        }
+    }
+
+    /**
+     * @brief 发送，通道满时挂起
+     * 挂起中的协程被取消时抛出 CancelledError，见 cancellation.h
+     * @return 通道已关闭返回false，此时 v 不会被移动
+     */
+    template<class U>
+    bool send(U&& v) {
+        while(true) {
+            if(SYLAR_UNLIKELY(isClosed())) {
+                return false;
+            }
+            if(SYLAR_LIKELY(pushData<U>(v))) {
+                notifyRecvWaiter();
+                return true;
+            }
+            m_lock.lock();
+            Register(m_sendWaiting);
+            if(isClosed()) {
+                Unregister(m_sendWaiting);
+                m_lock.unlock();
+                return false;
+            }
+            if(pushData<U>(v)) {
+                Unregister(m_sendWaiting);
+                m_lock.unlock();
+                notifyRecvWaiter();
+                return true;
+            }
+            // 唤醒者取出等待者时已经撤销登记
+            if(!m_sendWaiters.waitCancellable(m_lock)) {
+                interrupted(m_sendWaiters, m_sendWaiting);
+            }
+        }
+    }
+
+    /**
+     * @brief 非阻塞发送
+     * @return 通道满或已关闭返回false，此时 v 不会被移动
+     */
+    template<class U>
+    bool trySend(U&& v) {
+        if(isClosed() || !pushData<U>(v)) {
+            return false;
+        }
+        notifyRecvWaiter();
+        return true;
+    }
+
+    /**
+     * @brief 接收，通道空时挂起
+     * 挂起中的协程被取消时抛出 CancelledError
+     * @return 通道已关闭且没有剩余数据返回false
+     */
+    bool recv(T& v) {
+        while(true) {
+            if(SYLAR_LIKELY(popData(v))) {
+                notifySendWaiter();
+                return true;
+            }
+            m_lock.lock();
+            Register(m_recvWaiting);
+            if(popData(v)) {
+                Unregister(m_recvWaiting);
+                m_lock.unlock();
+                notifySendWaiter();
+                return true;
+            }
+            if(isClosed()) {
+                Unregister(m_recvWaiting);
+                m_lock.unlock();
+                return false;
+            }
+            if(!m_recvWaiters.waitCancellable(m_lock)) {
+                interrupted(m_recvWaiters, m_recvWaiting);
+            }
+        }
+    }
+
+    /**
+     * @brief 非阻塞接收
+     * @return 没有数据返回false
+     */
+    bool tryRecv(T& v) {
+        if(!popData(v)) {
+            return false;
+        }
+        notifySendWaiter();
+        return true;
+    }
+
+    /**
+     * @brief 批量接收：等到至少一个数据后，不再等待，尽量多取，最多 max 个
+     * @param[out] out 追加到末尾
+     * @return 取到的个数，通道已关闭且没有剩余数据返回0
+     */
+    size_t recvMany(std::vector<T>& out, size_t max) {
+        if(max == 0) {
+            return 0;
+        }
+        T v;
+        if(!recv(v)) {
+            return 0;
+        }
+        out.push_back(std::move(v));
+        size_t n = 1;
+        if(m_ring) {
+            while(n < max && m_ring->tryPop(v)) {
+                out.push_back(std::move(v));
+                ++n;
+                notifySendWaiter();
+            }
+        } else {
+            // 无界通道没有等待的发送者，一次加锁取完
+            Spinlock::Lock lock(m_dataLock);
+            while(n < max && !m_queue.empty()) {
+                out.push_back(std::move(m_queue.front()));
+                m_queue.pop_front();
+                ++n;
+            }
+        }
+        return n;
+    }
+
+    /**
+     * @brief 容量，0 表示无界
+     */
+    size_t capacity() const { return m_ring ? m_ring->capacity() : 0;}
+
+    /**
+     * @brief 近似的元素个数，并发时只作参考
+     */
+    size_t size() {
+        if(m_ring) {
+            return m_ring->size();
+        }
+        Spinlock::Lock lock(m_dataLock);
+        return m_queue.size();
+    }
+private:
+    /**
+     * @brief 数据通路，不处理等待者。失败时 v 不会被移动
+     */
+    template<class U>
+    bool pushData(U& v) {
+        if(m_ring) {
+            return m_ring->tryPush(std::forward<U>(v));
+        }
+        Spinlock::Lock lock(m_dataLock);
+        m_queue.push_back(std::forward<U>(v));
+        return true;
+    }
+
+    bool popData(T& v) {
+        if(m_ring) {
+            return m_ring->tryPop(v);
+        }
+        Spinlock::Lock lock(m_dataLock);
+        if(m_queue.empty()) {
+            return false;
+        }
+        v = std::move(m_queue.front());
+        m_queue.pop_front();
+        return true;
+    }
+private:
+    // 有界通道
+    std::unique_ptr<MpmcRingQueue<T> > m_ring;
+    // 无界通道
+    Spinlock m_dataLock;
+    std::deque<T> m_queue;
+};
+
+/**
+ * @brief 同时等待多个通道上的收/发，任意一个就绪即执行对应的回调
+ * 示例：
+ *   ChannelSelect sel;
+ *   sel.recv(ch1, [](int v) {...}).recv(ch2, [](std::string s) {...});
+ *   int idx = sel.wait();
+ * 多个分支同时就绪时轮流选择，避免总是偏向前面的分支。
+ * 发送分支的数据在成功后被移走，循环中使用时应每次重新构造 ChannelSelect
+ */
+class ChannelSelect {
+public:
+    ChannelSelect() = default;
+    ChannelSelect(const ChannelSelect&) = delete;
+    ChannelSelect& operator=(const ChannelSelect&) = delete;
+
+    /**
+     * @brief 添加接收分支，收到数据后调用 cb(T)
+     */
+    template<class T, class F>
+    ChannelSelect& recv(std::shared_ptr<Channel<T> > ch, F cb) {
+        m_cases.emplace_back(new RecvCase<T, F>(std::move(ch), std::move(cb)));
+        return *this;
+    }
+
+    /**
+     * @brief 添加发送分支，发送成功后调用 cb()
+     */
+    template<class T, class U, class F>
+    ChannelSelect& send(std::shared_ptr<Channel<T> > ch, U&& v, F cb) {
+        m_cases.emplace_back(new SendCase<T, F>(std::move(ch), T(std::forward<U>(v)), std::move(cb)));
+        return *this;
+    }
+
+    /**
+     * @brief 等待任意一个分支就绪并执行
+     * 需要挂起时如果协程已被取消，抛出 CancelledError；挂起后不可取消
+     * @return 执行的分支下标（按添加顺序），所有分支的通道都已关闭返回-1
+     */
+    int wait() { return select(true);}
+
+    /**
+     * @brief 不等待，执行一个已就绪的分支
+     * @return 执行的分支下标，没有就绪的分支返回-1
+     */
+    int tryWait() { return select(false);}
+private:
+    enum {
+        NOT_READY = 0,
+        READY = 1,
+        // 通道已关闭（接收分支还要求没有剩余数据），该分支永远不会就绪
+        CLOSED = 2
+    };
+
+    struct Case {
+        Case(ChannelBase* c, bool s)
+            :channel(c)
+            ,isSend(s) {
+        }
+        virtual ~Case() {}
+        /**
+         * @brief 尝试收/发，不唤醒对端、不调用回调，可以在持有 m_lock 时调用
+         */
+        virtual int tryOp() = 0;
+        /**
+         * @brief tryOp 成功后调用：唤醒对端并执行回调，不能持有 m_lock
+         */
+        virtual void complete() = 0;
+
+        FiberWaitQueue& queue() { return isSend ? channel->m_sendWaiters : channel->m_recvWaiters;}
+        std::atomic<uint32_t>& waiting() { return isSend ? channel->m_sendWaiting : channel->m_recvWaiting;}
+
+        ChannelBase* channel;
+        bool isSend;
+    };
+
+    template<class T, class F>
+    struct RecvCase : public Case {
+        RecvCase(std::shared_ptr<Channel<T> > c, F&& f)
+            :Case(c.get(), false)
+            ,ch(std::move(c))
+            ,cb(std::move(f)) {
+        }
+        int tryOp() override {
+            if(ch->popData(value)) {
+                return READY;
+            }
+            if(ch->isClosed()) {
+                // 关闭前放入的数据仍要取出
+                return ch->popData(value) ? READY : CLOSED;
+            }
+            return NOT_READY;
+        }
+        void complete() override {
+            ch->notifySendWaiter();
+            cb(std::move(value));
+        }
+        std::shared_ptr<Channel<T> > ch;
+        F cb;
+        T value;
+    };
+
+    template<class T, class F>
+    struct SendCase : public Case {
+        SendCase(std::shared_ptr<Channel<T> > c, T&& v, F&& f)
+            :Case(c.get(), true)
+            ,ch(std::move(c))
+            ,value(std::move(v))
+            ,cb(std::move(f)) {
+        }
+        int tryOp() override {
+            if(ch->isClosed()) {
+                return CLOSED;
+            }
+            return ch->pushData(value) ? READY : NOT_READY;
+        }
+        void complete() override {
+            ch->notifyRecvWaiter();
+            cb();
+        }
+        std::shared_ptr<Channel<T> > ch;
+        T value;
+        F cb;
+    };
+
+    int select(bool block);
+    /**
+     * @brief 先尝试分支 first（>= 0 时），再从 m_start 开始依次尝试其余分支
+     * @return 就绪分支的下标；没有就绪返回-1，全部关闭返回-2
+     */
+    int tryAll(int first = -1);
+    /**
+     * @brief 执行已就绪的分支 idx，不能持有 m_lock
+     * 唤醒本 select 的是分支 woken 的队列、而执行的分支在另一个队列上时，
+     * 这次唤醒没有被消费，转交给该队列的下一个等待者
+     */
+    void complete(int idx, int woken);
+private:
+    std::vector<std::unique_ptr<Case> > m_cases;
+    size_t m_start = 0;
+};
+
+}
+
+#endif
@@ -5,6 +5,16 @@
  * @date 2026-01-14
  */
 #include "config.h"
+#include "scheduler.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <fstream>
+#include <string_view>
+#include <tuple>
 
 
 namespace sylar {
@@ -35,7 +45,7 @@ ConfigVarBase::ptr Config::LookupBase(const std::string& name) {
 static void ListAllMember(const std::string& prefix,
                           const YAML::Node& node,
                           std::list<std::pair<std::string, const YAML::Node> >& output) {
-    if(prefix.find_first_not_of("abcdefghikjlmnopqrstuvwxyz._012345678")
+    if(prefix.find_first_not_of("abcdefghikjlmnopqrstuvwxyz._0123456789")
             != std::string::npos) {
         SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "Config invalid name: " << prefix << " : " << node;
         return;
@@ -54,7 +64,7 @@ static void ListAllMember(const std::string& prefix,
 }
 
 /**
- * @brief 按 key 找到已注册的 ConfigVar，然后把 YAML 节点转成字符串，写进去
+ * @brief 按 key 找到已注册的 ConfigVar，然后把 YAML 节点直接转换后写进去
  * 
  * @param node 
  */
@@ -74,18 +84,464 @@ void Config::LoadFromYaml(const YAML::Node& node) {
         ConfigVarBase::ptr var = LookupBase(key);
         // 只处理已注册的配置项
         if(var) {
-            if(i.second.IsScalar()) {
-                // 
-                var->fromString(i.second.Scalar());
-            } else {
-                // 特殊项特殊处理
-                std::stringstream ss;
-                // Node 重新 dump 成 YAML 文本（yaml-cpp 已对<<重载）
-                ss << i.second;
-                var->fromString(ss.str());
+            // 不再把非标量 Node 重新 dump 成 YAML 文本再交给 fromString 解析，
+            // 由 Lexical_cast<YAML::Node, T> 直接从节点转换
+            var->fromYaml(i.second);
+        }
+    }
+}
+
+bool ConfigVarBase::dispatchListener(std::function<void()> task) {
+    Scheduler* sc = m_listenerScheduler;
+    // 派发前被切回同步模式，或调度器已停止，由调用者在当前线程执行
+    return sc && sc->schedule(std::move(task));
+}
+
+typedef std::function<void(const std::vector<std::string>&)> ReloadCb;
+
+// 与 Config::GetDatas() 同理，使用函数内静态变量避免初始化顺序问题
+static Mutex& GetTransactionMutex() {
+    static Mutex s_mutex;
+    return s_mutex;
+}
+
+static Mutex& GetReloadMutex() {
+    static Mutex s_mutex;
+    return s_mutex;
+}
+
+static std::map<uint64_t, ReloadCb>& GetReloadCbs() {
+    static std::map<uint64_t, ReloadCb> s_cbs;
+    return s_cbs;
+}
+
+static uint64_t s_reload_cb_id = 0;
+
+/**
+ * @brief 事务的提交阶段：调用时持有事务锁 lock，prepared 都已解析成功
+ * 提交全部暂存值后释放事务锁（回调可能再次加载配置），再触发变化配置项的回调和 reload 回调
+ * @return 发生变化的配置项数
+ */
+static size_t CommitTransaction(const std::vector<ConfigVarBase::ptr>& prepared, Mutex::Lock& lock) {
+    std::vector<std::string> names;
+    std::vector<std::function<void()> > notifies;
+    for(auto& i : prepared) {
+        auto notify = i->commitPrepared();
+        if(notify) {
+            names.push_back(i->getName());
+            notifies.push_back(std::move(notify));
+        }
+    }
+    lock.unlock();
+    for(auto& i : notifies) {
+        i();
+    }
+
+    std::map<uint64_t, ReloadCb> cbs;
+    {
+        Mutex::Lock lock(GetReloadMutex());
+        cbs = GetReloadCbs();
+    }
+    for(auto& i : cbs) {
+        i.second(names);
+    }
+    return names.size();
+}
+
+/**
+ * @brief 事务的 prepare 阶段：把 nodes 中已注册的配置项依次解析到暂存区，调用时持有事务锁
+ * 任意一项解析失败时，已解析的暂存区全部丢弃（回滚），所有配置项保持原值
+ * @param[out] prepared 按首次出现的顺序记录，同一配置项只出现一次
+ * @param[out] unregistered 非空时记录没有注册的 key
+ * @return 全部解析成功返回true
+ */
+static bool PrepareYamls(const std::vector<YAML::Node>& nodes, std::vector<ConfigVarBase::ptr>& prepared
+        , std::set<std::string>* unregistered = nullptr) {
+    std::set<ConfigVarBase*> prepared_set;
+    for(auto& node : nodes) {
+        std::list<std::pair<std::string, const YAML::Node> > all_nodes;
+        ListAllMember("", node, all_nodes);
+        for(auto& i : all_nodes) {
+            std::string key = i.first;
+            if(key.empty()) {
+                continue;
+            }
+            std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+            ConfigVarBase::ptr var = Config::LookupBase(key);
+            if(!var) {
+                if(unregistered) {
+                    unregistered->insert(key);
+                }
+                continue;
+            }
+            if(prepared_set.insert(var.get()).second) {
+                prepared.push_back(var);
+            }
+            if(!var->prepareFromYaml(i.second)) {
+                for(auto& j : prepared) {
+                    j->discardPrepared();
+                }
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool Config::LoadFromYamls(const std::vector<YAML::Node>& nodes) {
+    // 事务之间串行，ConfigVar 的暂存区只在这把锁内访问
+    Mutex::Lock lock(GetTransactionMutex());
+
+    // 同一配置项只会 commit / notify 一次
+    std::vector<ConfigVarBase::ptr> prepared;
+    if(!PrepareYamls(nodes, prepared)) {
+        SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "Config::LoadFromYamls rollback, "
+            << prepared.size() << " prepared vars discarded";
+        return false;
+    }
+
+    size_t changed = CommitTransaction(prepared, lock);
+    SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "Config::LoadFromYamls commit, prepared="
+        << prepared.size() << " changed=" << changed;
+    return true;
+}
+
+/**
+ * @brief 列出目录下所有 .yml 文件，按文件名排序
+ */
+static bool ListConfFiles(const std::string& path, std::vector<std::string>& files) {
+    DIR* dir = opendir(path.c_str());
+    if(!dir) {
+        SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "Config::ListConfFiles opendir fail, path=" << path;
+        return false;
+    }
+    struct dirent* dp = nullptr;
+    while((dp = readdir(dir)) != nullptr) {
+        std::string name = dp->d_name;
+        if(name.size() > 4 && name.compare(name.size() - 4, 4, ".yml") == 0) {
+            files.push_back(path + "/" + name);
+        }
+    }
+    closedir(dir);
+    // readdir 的顺序不确定，排序保证覆盖顺序稳定
+    std::sort(files.begin(), files.end());
+    return true;
+}
+
+bool Config::LoadFromConfDir(const std::string& path) {
+    std::vector<std::string> files;
+    if(!ListConfFiles(path, files)) {
+        return false;
+    }
+
+    // 先把所有文件都解析完，再进入事务，任何文件语法错误都不会改动配置
+    std::vector<YAML::Node> nodes;
+    for(auto& i : files) {
+        try {
+            nodes.push_back(YAML::LoadFile(i));
+        } catch(std::exception& e) {
+            SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "Config::LoadFromConfDir load file fail, file="
+                << i << " " << e.what();
+            return false;
+        }
+    }
+    return LoadFromYamls(nodes);
+}
+
+/**
+ * 快照文件格式（主机字节序，整体可直接 mmap 后按偏移读取）：
+ * | SnapshotHeader |
+ * | file_count 个  : u32 path_len | path | i64 mtime_ns | u64 size |
+ * | entry_count 个 : u32 name_len | name | u32 type_len | type | u32 val_len | val |
+ * entry 只有 yml 中出现的 key，没有注册的 key 的 type 和 val 为空
+ * header 之后的部分统称 payload，header 中记录其长度和校验和
+ */
+static const char s_snapshot_magic[8] = {'S', 'Y', 'L', 'C', 'F', 'G', 'S', 'N'};
+// 2：只记录 yml 中出现的 key，值取自 yml 而不是当前值
+static const uint32_t s_snapshot_version = 2;
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t file_count;
+    uint32_t entry_count;
+    uint32_t reserved;
+    uint64_t payload_size;
+    uint64_t checksum;
+};
+
+struct ConfFileStat {
+    std::string path;
+    int64_t mtime;
+    uint64_t size;
+};
+
+// FNV-1a
+static uint64_t SnapshotChecksum(const char* data, size_t len) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for(size_t i = 0; i < len; ++i) {
+        h ^= static_cast<uint8_t>(data[i]);
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static bool StatConfFiles(const std::string& path, std::vector<ConfFileStat>& stats) {
+    std::vector<std::string> files;
+    if(!ListConfFiles(path, files)) {
+        return false;
+    }
+    for(auto& i : files) {
+        struct stat st;
+        if(stat(i.c_str(), &st)) {
+            return false;
+        }
+        stats.push_back({i, (int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec,
+                        (uint64_t)st.st_size});
+    }
+    return true;
+}
+
+template<class T>
+static void SnapshotPut(std::string& out, const T& v) {
+    out.append((const char*)&v, sizeof(v));
+}
+
+static void SnapshotPutString(std::string& out, const std::string& v) {
+    SnapshotPut(out, (uint32_t)v.size());
+    out.append(v);
+}
+
+/**
+ * @brief 按顺序读取 payload，任何越界都会使 isError() 为 true
+ */
+class SnapshotReader {
+public:
+    SnapshotReader(const char* begin, const char* end)
+        :m_cur(begin)
+        ,m_end(end) {
+    }
+
+    template<class T>
+    T get() {
+        T v {};
+        if(m_error || (size_t)(m_end - m_cur) < sizeof(T)) {
+            m_error = true;
+            return v;
+        }
+        memcpy(&v, m_cur, sizeof(T));
+        m_cur += sizeof(T);
+        return v;
+    }
+
+    std::string_view getString() {
+        uint32_t len = get<uint32_t>();
+        if(m_error || (size_t)(m_end - m_cur) < len) {
+            m_error = true;
+            return std::string_view();
+        }
+        std::string_view v(m_cur, len);
+        m_cur += len;
+        return v;
+    }
+
+    bool isError() const { return m_error;}
+    bool isEnd() const { return m_cur == m_end;}
+private:
+    const char* m_cur;
+    const char* m_end;
+    bool m_error = false;
+};
+
+bool Config::SaveSnapshot(const std::string& path, const std::string& conf_dir) {
+    // 先 stat 再解析：解析期间文件被修改时，记录的 mtime 比内容旧，下次加载时视为过期
+    std::vector<ConfFileStat> stats;
+    if(!StatConfFiles(conf_dir, stats)) {
+        return false;
+    }
+    std::vector<YAML::Node> nodes;
+    for(auto& i : stats) {
+        try {
+            nodes.push_back(YAML::LoadFile(i.path));
+        } catch(std::exception& e) {
+            SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "Config::SaveSnapshot load file fail, file="
+                << i.path << " " << e.what();
+            return false;
+        }
+    }
+
+    // 借用事务的暂存区得到 yml 中的值，不修改当前值；没有注册的 key 类型记为空串
+    std::vector<std::tuple<std::string, std::string, std::string> > entries;
+    {
+        Mutex::Lock lock(GetTransactionMutex());
+        std::vector<ConfigVarBase::ptr> prepared;
+        std::set<std::string> unregistered;
+        if(!PrepareYamls(nodes, prepared, &unregistered)) {
+            SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "Config::SaveSnapshot bad value, conf_dir=" << conf_dir;
+            return false;
+        }
+        for(auto& i : prepared) {
+            entries.emplace_back(i->getName(), i->getTypeName(), i->preparedToString());
+            i->discardPrepared();
+        }
+        for(auto& i : unregistered) {
+            entries.emplace_back(i, std::string(), std::string());
+        }
+    }
+
+    std::string payload;
+    for(auto& i : stats) {
+        SnapshotPutString(payload, i.path);
+        SnapshotPut(payload, i.mtime);
+        SnapshotPut(payload, i.size);
+    }
+    for(auto& i : entries) {
+        SnapshotPutString(payload, std::get<0>(i));
+        SnapshotPutString(payload, std::get<1>(i));
+        SnapshotPutString(payload, std::get<2>(i));
+    }
+
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, s_snapshot_magic, sizeof(header.magic));
+    header.version = s_snapshot_version;
+    header.file_count = stats.size();
+    header.entry_count = entries.size();
+    header.payload_size = payload.size();
+    header.checksum = SnapshotChecksum(payload.data(), payload.size());
+
+    // 先写临时文件再 rename，读者不会看到写了一半的快照
+    std::string tmp = path + ".tmp";
+    {
+        std::ofstream ofs(tmp, std::ios::binary | std::ios::trunc);
+        if(!ofs) {
+            SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "Config::SaveSnapshot open fail, path=" << tmp;
+            return false;
+        }
+        ofs.write((const char*)&header, sizeof(header));
+        ofs.write(payload.data(), payload.size());
+        if(!ofs) {
+            SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "Config::SaveSnapshot write fail, path=" << tmp;
+            return false;
+        }
+    }
+    if(rename(tmp.c_str(), path.c_str())) {
+        SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "Config::SaveSnapshot rename fail, path=" << path;
+        return false;
+    }
+    return true;
+}
+
+bool Config::LoadFromSnapshot(const std::string& path, const std::string& conf_dir) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if(fstat(fd, &st) || (size_t)st.st_size < sizeof(SnapshotHeader)) {
+        close(fd);
+        return false;
+    }
+    size_t len = st.st_size;
+    void* addr = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(addr == MAP_FAILED) {
+        return false;
+    }
+    // 离开作用域时 munmap
+    std::shared_ptr<void> unmap(addr, [len](void* p) { munmap(p, len); });
+
+    const char* data = (const char*)addr;
+    SnapshotHeader header;
+    memcpy(&header, data, sizeof(header));
+    if(memcmp(header.magic, s_snapshot_magic, sizeof(header.magic))
+            || header.version != s_snapshot_version
+            || header.payload_size != len - sizeof(header)
+            || header.checksum != SnapshotChecksum(data + sizeof(header), header.payload_size)) {
+        SYLAR_LOG_WARN(SYLAR_LOG_ROOT()) << "Config::LoadFromSnapshot invalid snapshot, path=" << path;
+        return false;
+    }
+
+    SnapshotReader reader(data + sizeof(header), data + len);
+    // 1、yml 文件集合、mtime、大小必须与生成快照时一致
+    std::vector<ConfFileStat> stats;
+    if(!StatConfFiles(conf_dir, stats) || stats.size() != header.file_count) {
+        return false;
+    }
+    for(auto& i : stats) {
+        std::string_view file = reader.getString();
+        int64_t mtime = reader.get<int64_t>();
+        uint64_t size = reader.get<uint64_t>();
+        if(reader.isError() || file != i.path || mtime != i.mtime || size != i.size) {
+            SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "Config::LoadFromSnapshot stale snapshot, file=" << i.path;
+            return false;
+        }
+    }
+
+    // 2、快照中的 key 现在的注册状态和类型必须与生成时一致，否则说明程序版本变了
+    // yml 中没有出现的配置项不在快照中，保持当前值
+    std::vector<std::pair<ConfigVarBase::ptr, std::string_view> > vars;
+    for(uint32_t i = 0; i < header.entry_count; ++i) {
+        std::string_view name = reader.getString();
+        std::string_view type = reader.getString();
+        std::string_view val = reader.getString();
+        if(reader.isError()) {
+            return false;
+        }
+        ConfigVarBase::ptr var = LookupBase(std::string(name));
+        if(type.empty() ? (bool)var : (!var || var->getTypeName() != type)) {
+            SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "Config::LoadFromSnapshot registered vars changed, name="
+                << name << " path=" << path;
+            return false;
+        }
+        if(var) {
+            vars.push_back(std::make_pair(var, val));
+        }
+    }
+    if(!reader.isEnd()) {
+        return false;
+    }
+
+    // 3、全部校验通过后与 LoadFromYamls 走同一个事务，任意一个值解析失败都不修改配置项
+    Mutex::Lock lock(GetTransactionMutex());
+    std::vector<ConfigVarBase::ptr> prepared;
+    for(auto& i : vars) {
+        if(!i.first->prepareFromString(std::string(i.second))) {
+            for(auto& j : prepared) {
+                j->discardPrepared();
             }
+            SYLAR_LOG_WARN(SYLAR_LOG_ROOT()) << "Config::LoadFromSnapshot bad value, name="
+                << i.first->getName() << " path=" << path;
+            return false;
         }
+        prepared.push_back(i.first);
     }
+    size_t changed = CommitTransaction(prepared, lock);
+    SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "Config::LoadFromSnapshot commit, vars="
+        << prepared.size() << " changed=" << changed;
+    return true;
+}
+
+bool Config::LoadFromConfDir(const std::string& path, const std::string& snapshot_path) {
+    if(LoadFromSnapshot(snapshot_path, path)) {
+        return true;
+    }
+    if(!LoadFromConfDir(path)) {
+        return false;
+    }
+    SaveSnapshot(snapshot_path, path);
+    return true;
+}
+
+uint64_t Config::AddReloadListener(std::function<void(const std::vector<std::string>&)> cb) {
+    Mutex::Lock lock(GetReloadMutex());
+    GetReloadCbs()[++s_reload_cb_id] = cb;
+    return s_reload_cb_id;
+}
+
+void Config::DelReloadListener(uint64_t key) {
+    Mutex::Lock lock(GetReloadMutex());
+    GetReloadCbs().erase(key);
 }
 
 void Config::Visit(std::function<void(ConfigVarBase::ptr)> cb) {
@@ -19,13 +19,20 @@
 #include <unordered_map>
 #include <unordered_set>
 #include <concepts>
+#include <charconv>
+#include <stdexcept>
 #include <functional>
+#include <atomic>
 #include "log.h"
 #include "thread.h"
 
 namespace sylar {
 
-class ConfigVarBase {
+// 只用到指针，前置声明即可，避免 config.h 依赖 scheduler.h
+class Scheduler;
+
+// 继承 enable_shared_from_this，异步回调任务需要持有配置项的智能指针
+class ConfigVarBase : public std::enable_shared_from_this<ConfigVarBase> {
 public:
     typedef std::shared_ptr<ConfigVarBase> ptr;
     ConfigVarBase(const std::string& name, const std::string& description = "") 
@@ -42,11 +49,74 @@ public:
 
     virtual std::string toString() = 0;
     virtual bool fromString(const std::string& val) = 0;
+    /**
+     * @brief 直接从YAML节点转换为T类型
+     * 省去了把节点 dump 成文本再由 YAML::Load 重新解析的往返开销
+     * 
+     * @param node YAML的Node节点
+     * @return true 转换成功
+     */
+    virtual bool fromYaml(const YAML::Node& node) = 0;
     // 虚函数，map里的配置类才能调用他们的方法
     virtual std::string getTypeName() const = 0;
+
+    /**
+     * 以下接口供 Config 的事务式加载使用：
+     * prepare 阶段只解析到暂存区，不改变当前值；
+     * 所有配置项都解析成功后再逐个 commit；
+     * 全部 commit 完成、释放事务锁之后才调用 commit 返回的通知函数，回调里看到的是一致的新状态
+     */
+    /**
+     * @brief 把YAML节点解析到暂存区，不修改当前值
+     * 
+     * @return true 解析成功
+     */
+    virtual bool prepareFromYaml(const YAML::Node& node) = 0;
+    /**
+     * @brief 把 toString() 格式的字符串解析到暂存区，不修改当前值（用于快照）
+     * 
+     * @return true 解析成功
+     */
+    virtual bool prepareFromString(const std::string& val) = 0;
+    /**
+     * @brief 暂存值的 toString() 格式，没有暂存值返回空串（用于生成快照）
+     */
+    virtual std::string preparedToString() = 0;
+    /**
+     * @brief 丢弃暂存区（事务回滚）
+     */
+    virtual void discardPrepared() = 0;
+    /**
+     * @brief 暂存值写入当前值，不触发回调
+     * 
+     * @return 值发生了变化时返回触发回调的函数（已持有旧值，可以在事务锁外调用）；没有变化返回nullptr
+     */
+    virtual std::function<void()> commitPrepared() = 0;
+
+    /**
+     * @brief 设置回调的派发调度器
+     * nullptr（默认）：在 setValue 的线程中同步调用回调
+     * 非nullptr：值先写入，回调作为任务投递到该调度器上执行，setValue 不再被慢回调阻塞。
+     * 同一配置项的回调任务同一时刻最多只有一个，保证顺序；
+     * 任务执行前的多次连续修改会合并为一次通知（旧值为第一次修改前的值，新值为最后一次的值）
+     * 
+     * @attention 调度器对象的生命周期必须长于该配置项的修改；调度器停止后不再接受任务，
+     *            此时回调退回到修改者的线程同步执行
+     * @param sc 调度器
+     */
+    void setListenerScheduler(Scheduler* sc) { m_listenerScheduler = sc;}
+    Scheduler* getListenerScheduler() const { return m_listenerScheduler;}
+protected:
+    /**
+     * @brief 把回调任务投递到 m_listenerScheduler 上
+     * 实现放在 config.cpp 中
+     * @return 调度器接受了任务返回true；没有调度器或调度器已停止返回false，task 不会执行
+     */
+    bool dispatchListener(std::function<void()> task);
 protected:
     std::string m_name;
     std::string m_description;
+    std::atomic<Scheduler*> m_listenerScheduler{nullptr};
 };
 
 // F from_type; T to_type
@@ -60,6 +130,134 @@ public:
     }
 };
 
+// YAML::Node -> T 的通用版本
+// 标量直接取出 Scalar() 走字符串转换，不再经过 dump；
+// 非标量（比如只全特化了 string 版本的自定义类型）才退回到 dump 成文本的旧路径
+template<class T>
+class Lexical_cast<YAML::Node, T> {
+public:
+    T operator()(const YAML::Node& node) {
+        if(node.IsScalar()) {
+            return Lexical_cast<std::string, T>()(node.Scalar());
+        }
+        std::stringstream ss;
+        ss << node;
+        return Lexical_cast<std::string, T>()(ss.str());
+    }
+};
+
+// T -> YAML::Node 的通用版本，供容器序列化时逐个元素构造子节点
+// 自定义类型只需全特化 T -> string，这里再解析成节点
+template<class T>
+class Lexical_cast<T, YAML::Node> {
+public:
+    YAML::Node operator()(const T& v) {
+        return YAML::Load(Lexical_cast<T, std::string>()(v));
+    }
+};
+
+// 可以用 from_chars / to_chars 转换的算术类型
+// bool 和字符类型保持 boost::lexical_cast 的语义（"1"/"0"、单个字符），不走这里
+template<class T>
+concept CharsConvertible =
+    (std::integral<T> || std::floating_point<T>)
+    && !std::same_as<T, bool>
+    && !std::same_as<T, char> && !std::same_as<T, signed char>
+    && !std::same_as<T, unsigned char> && !std::same_as<T, wchar_t>
+    && !std::same_as<T, char8_t> && !std::same_as<T, char16_t>
+    && !std::same_as<T, char32_t>;
+
+// 足够容纳任意整数以及浮点数的最短往返表示
+inline constexpr size_t CHARS_BUFFER_SIZE = 64;
+
+/**
+ * @brief 把 v 写入 buf，返回写入的长度，不分配内存
+ * 浮点数输出最短的可往返表示，比 lexical_cast 的 17 位有效数字更短且同样精确
+ */
+template<CharsConvertible T>
+size_t ToChars(char* buf, size_t size, T v) {
+    auto res = std::to_chars(buf, buf + size, v);
+    if(res.ec != std::errc()) {
+        throw std::overflow_error("ToChars buffer too small");
+    }
+    return res.ptr - buf;
+}
+
+/**
+ * @brief string -> 算术类型，不经过 iostream
+ * 与 boost::lexical_cast 一样要求整个字符串都被消费，并兼容前导 '+'
+ */
+template<CharsConvertible T>
+class Lexical_cast<std::string, T> {
+public:
+    T operator()(const std::string& str) {
+        const char* first = str.data();
+        const char* last = first + str.size();
+        // from_chars 不接受前导 '+'
+        if(first != last && *first == '+' && (last - first == 1 || first[1] != '-')) {
+            ++first;
+        }
+        T val{};
+        auto res = std::from_chars(first, last, val);
+        if(res.ec == std::errc::result_out_of_range) {
+            throw std::out_of_range("Lexical_cast out of range: " + str
+                    + " to " + typeid(T).name());
+        }
+        if(res.ec != std::errc() || res.ptr != last) {
+            throw std::invalid_argument("Lexical_cast invalid: " + str
+                    + " to " + typeid(T).name());
+        }
+        return val;
+    }
+};
+
+template<CharsConvertible T>
+class Lexical_cast<T, std::string> {
+public:
+    std::string operator()(const T& v) {
+        char buf[CHARS_BUFFER_SIZE];
+        return std::string(buf, ToChars(buf, sizeof(buf), v));
+    }
+};
+
+// 算术类型直接构造标量节点，不再先转成字符串再 YAML::Load
+template<CharsConvertible T>
+class Lexical_cast<T, YAML::Node> {
+public:
+    YAML::Node operator()(const T& v) {
+        char buf[CHARS_BUFFER_SIZE];
+        return YAML::Node(std::string(buf, ToChars(buf, sizeof(buf), v)));
+    }
+};
+
+template<>
+class Lexical_cast<std::string, std::string> {
+public:
+    std::string operator()(const std::string& v) {
+        return v;
+    }
+};
+
+// 字符串元素总是标量，不再 YAML::Load（"a: b" 这样的元素原来会被解析成map）
+template<>
+class Lexical_cast<std::string, YAML::Node> {
+public:
+    YAML::Node operator()(const std::string& v) {
+        return YAML::Node(v);
+    }
+};
+
+/**
+ * @brief 把节点一次性输出成文本
+ * 容器的所有元素都先挂到同一棵节点树上，最后只经过一个 Emitter 的缓冲区，
+ * 不再每个元素 stringstream + YAML::Load 一次
+ */
+inline std::string YamlToString(const YAML::Node& node) {
+    YAML::Emitter out;
+    out << node;
+    return std::string(out.c_str(), out.size());
+}
+
 // // 容器判定 C++ 20之前
 // // vector / list 的判定
 // template<class T>
@@ -118,27 +316,28 @@ template<class T>
 concept InsertableContainer =
     SequenceContainer<T> || SetContainer<T>;
 
+/**
+ * @brief YAML::Node -> Container
+ * 子节点直接递归交给 Lexical_cast<YAML::Node, ValueType>，
+ * 不再对每个元素 dump 成文本后再 YAML::Load 一次
+ */
 template<InsertableContainer Container>
-class Lexical_cast<std::string, Container> {
+class Lexical_cast<YAML::Node, Container> {
 public:
-    Container operator()(const std::string& str) {
-        YAML::Node node = YAML::Load(str);
+    Container operator()(const YAML::Node& node) {
         Container container;
         // yaml不支持set类型的转换
         // Container container = node.as<Container>();
-        std::stringstream ss;
+        if(!node.IsSequence()) {
+            return container;
+        }
         using ValueType = typename Container::value_type;
-        for (size_t i = 0; i < node.size(); ++i) {
-            ss.str("");
-            ss.clear();
-            ss << node[i];
-            ValueType value =
-                Lexical_cast<std::string, ValueType>()(ss.str());
+        for(auto it = node.begin(); it != node.end(); ++it) {
             // 使用 if constexpr 进行区分
             if constexpr (SequenceContainer<Container>) {
-                container.push_back(value);
+                container.push_back(Lexical_cast<YAML::Node, ValueType>()(*it));
             } else {
-                container.insert(value);
+                container.insert(Lexical_cast<YAML::Node, ValueType>()(*it));
             }
         }
         return container;
@@ -146,58 +345,82 @@ public:
 };
 
 template<InsertableContainer Container>
-class Lexical_cast<Container, std::string> {
+class Lexical_cast<std::string, Container> {
 public:
-    std::string operator()(const Container& v) {
+    Container operator()(const std::string& str) {
+        // 只在最外层解析一次，内部元素走节点转换
+        return Lexical_cast<YAML::Node, Container>()(YAML::Load(str));
+    }
+};
+
+template<InsertableContainer Container>
+class Lexical_cast<Container, YAML::Node> {
+public:
+    YAML::Node operator()(const Container& v) {
         YAML::Node node(YAML::NodeType::Sequence);
         using ValueType = typename Container::value_type;
         for (auto& i : v) {
-            node.push_back(YAML::Load(Lexical_cast<ValueType, std::string>()(i)));
+            node.push_back(Lexical_cast<ValueType, YAML::Node>()(i));
         }
-        std::stringstream ss;
-        ss << node;
-        return ss.str();
+        return node;
+    }
+};
+
+template<InsertableContainer Container>
+class Lexical_cast<Container, std::string> {
+public:
+    std::string operator()(const Container& v) {
+        return YamlToString(Lexical_cast<Container, YAML::Node>()(v));
     }
 };
 
 template<StringKeyMapContainer Container>
-class Lexical_cast<std::string, Container> {
+class Lexical_cast<YAML::Node, Container> {
 public:
-    Container operator()(const std::string& v) {
-        YAML::Node node = YAML::Load(v);
+    Container operator()(const YAML::Node& node) {
         Container container;
         // // yaml原生支持map
         // 但map里不能包含不支持的类型，比如自定义类
         // Container container = node.as<Container>();
-        std::stringstream ss;
+        using MappedType = typename Container::mapped_type;
         for(auto it = node.begin();
                 it != node.end(); ++it) {
-            using MappedType = typename Container::mapped_type;
-            ss.str("");
-            ss.clear();
-            ss << it->second;
             container.insert(std::make_pair(it->first.Scalar(),
-                        Lexical_cast<std::string, MappedType>()(ss.str())));
+                        Lexical_cast<YAML::Node, MappedType>()(it->second)));
         }
         return container;
     }
 };
 
 template<StringKeyMapContainer Container>
-class Lexical_cast<Container, std::string> {
+class Lexical_cast<std::string, Container> {
 public:
-    std::string operator()(const Container& v) {
+    Container operator()(const std::string& v) {
+        return Lexical_cast<YAML::Node, Container>()(YAML::Load(v));
+    }
+};
+
+template<StringKeyMapContainer Container>
+class Lexical_cast<Container, YAML::Node> {
+public:
+    YAML::Node operator()(const Container& v) {
         YAML::Node node(YAML::NodeType::Map);
         for(auto& i : v) {
             using MappedType = typename Container::mapped_type;
-            node[i.first] = YAML::Load(Lexical_cast<MappedType, std::string>()(i.second));
+            node[i.first] = Lexical_cast<MappedType, YAML::Node>()(i.second);
         }
         // // yaml原生支持map
         // 但map里不能包含不支持的类型，比如自定义类
         // YAML::Node node(v);
-        std::stringstream ss;
-        ss << node;
-        return ss.str();
+        return node;
+    }
+};
+
+template<StringKeyMapContainer Container>
+class Lexical_cast<Container, std::string> {
+public:
+    std::string operator()(const Container& v) {
+        return YamlToString(Lexical_cast<Container, YAML::Node>()(v));
     }
 };
 
@@ -282,11 +505,102 @@ public:
 
 
 
+// 可以按元素做差异比较的容器：set 类（按 key 查找）和 string 为 key 的 map 类
+template<class T>
+concept DiffableContainer =
+    SetContainer<T> || StringKeyMapContainer<T>;
+
+/**
+ * @brief 容器配置项一次变化的差异
+ * 主模板为空，只有 DiffableContainer 才有意义
+ */
+template<class T>
+struct ConfigDiff {
+};
+
+/**
+ * @brief set 类容器的差异
+ * 用 find 在另一侧查找同一个元素：找不到为增删；
+ * 找到但 == 不相等的为修改（比如 set<LogDefine> 按 name 排序，name 相同而 level 不同）
+ */
+template<SetContainer T>
+struct ConfigDiff<T> {
+    typedef typename T::value_type value_type;
+    struct Changed {
+        value_type old_value;
+        value_type new_value;
+    };
+
+    std::vector<value_type> added;
+    std::vector<value_type> removed;
+    std::vector<Changed> changed;
+
+    bool empty() const { return added.empty() && removed.empty() && changed.empty();}
+
+    static ConfigDiff Compute(const T& old_val, const T& new_val) {
+        ConfigDiff diff;
+        for(auto& i : new_val) {
+            auto it = old_val.find(i);
+            if(it == old_val.end()) {
+                diff.added.push_back(i);
+            } else if(!(*it == i)) {
+                diff.changed.push_back(Changed{*it, i});
+            }
+        }
+        for(auto& i : old_val) {
+            if(new_val.find(i) == new_val.end()) {
+                diff.removed.push_back(i);
+            }
+        }
+        return diff;
+    }
+};
+
+/**
+ * @brief map 类容器的差异，按 key 比较
+ */
+template<StringKeyMapContainer T>
+struct ConfigDiff<T> {
+    typedef typename T::key_type key_type;
+    typedef typename T::mapped_type mapped_type;
+    struct Changed {
+        key_type key;
+        mapped_type old_value;
+        mapped_type new_value;
+    };
+
+    std::vector<std::pair<key_type, mapped_type> > added;
+    std::vector<std::pair<key_type, mapped_type> > removed;
+    std::vector<Changed> changed;
+
+    bool empty() const { return added.empty() && removed.empty() && changed.empty();}
+
+    static ConfigDiff Compute(const T& old_val, const T& new_val) {
+        ConfigDiff diff;
+        for(auto& i : new_val) {
+            auto it = old_val.find(i.first);
+            if(it == old_val.end()) {
+                diff.added.emplace_back(i.first, i.second);
+            } else if(!(it->second == i.second)) {
+                diff.changed.push_back(Changed{i.first, it->second, i.second});
+            }
+        }
+        for(auto& i : old_val) {
+            if(new_val.find(i.first) == new_val.end()) {
+                diff.removed.emplace_back(i.first, i.second);
+            }
+        }
+        return diff;
+    }
+};
+
 // FromStr T operator()(const std::string& str) | str -> T
 // Tostr std::string operator()(const T&) | T -> str
-// 后面两个使用默认值，且这个默认值是Lexical_cast的对应模板
+// FromNode T operator()(const YAML::Node& node) | node -> T
+// 后面三个使用默认值，且这个默认值是Lexical_cast的对应模板
 template<class T, class FromStr = Lexical_cast<std::string, T>
-                , class ToStr = Lexical_cast<T, std::string> >
+                , class ToStr = Lexical_cast<T, std::string>
+                , class FromNode = Lexical_cast<YAML::Node, T> >
 class ConfigVar : public ConfigVarBase {
 public:
     // 在类内部 ConfigVar 等价于 ConfigVar<T>
@@ -294,6 +608,8 @@ public:
     // 定义配置事件的接口，一个“当值发生变化时被调用的回调函数类型”
     // 观察者模式（函数式版本）
     typedef std::function<void (const T& old_value, const T& new_value) > on_change_cb;
+    // 差异回调，只对 DiffableContainer 可用
+    typedef std::function<void (const ConfigDiff<T>& diff) > on_diff_cb;
     typedef RWMutex RWMutexType;
 
     ConfigVar(const std::string& name
@@ -332,12 +648,42 @@ public:
         }
         return false;
     }
+
+    // YAML节点直接转T类型
+    bool fromYaml(const YAML::Node& node) override {
+        try {
+            setValue(FromNode()(node));
+            return true;
+        }catch(std::exception& e) {
+            SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "ConfigVar::fromYaml exception "
+                << e.what() << " convert: yaml to " << typeid(m_val).name()
+                << " - yaml_val: " << node;
+        }
+        return false;
+    }
     // 返回const引用
     const T& getValue() const { 
         RWMutexType::ReadLock lock(m_mutex);
         return m_val;
     }
     void setValue(const T& val) {
+        if(m_listenerScheduler) {
+            // 异步派发：先写入，再把通知交给调度器
+            bool post = false;
+            {
+                RWMutexType::WriteLock lock(m_mutex);
+                if(val == m_val) {
+                    return;
+                }
+                // 在写锁内记录，记录的先后与写入的先后一致，最后一次写入的值一定会被通知
+                post = recordNotify(m_val, val);
+                m_val = val;
+            }
+            if(post) {
+                postNotify();
+            }
+            return;
+        }
         // 局部锁
         { 
             // 回调函数的时间可能很长，可以用读锁
@@ -347,9 +693,7 @@ public:
                 return;
             }
             // 逐个通知
-            for(auto& i : m_cbs) {
-                i.second(m_val, val);
-            }
+            notifyListeners(m_cbs, m_diffCbs, m_val, val);
         }
         // 修改时改为写锁
         RWMutexType::WriteLock lock(m_mutex);
@@ -369,9 +713,26 @@ public:
         return m_fun_id;
     }
 
+    /**
+     * @brief 添加差异回调，回调只收到增加、删除、修改的元素
+     * 差异在每次变化时只计算一次，由所有差异回调共享，
+     * 大容器中改动一项时订阅者不必各自对整个容器重新比较
+     *
+     * @return 回调的key，与 addListener 共用编号，同样用 delListener 删除
+     */
+    uint64_t addDiffListener(on_diff_cb cb) requires DiffableContainer<T> {
+        RWMutexType::WriteLock lock(m_mutex);
+        ++m_fun_id;
+        m_diffCbs[m_fun_id] = cb;
+
+        SYLAR_LOG_DEBUG(SYLAR_LOG_ROOT()) << getTypeName() << ": An diff listener has been added.";
+        return m_fun_id;
+    }
+
     void delListener(uint64_t key) {
         RWMutexType::WriteLock lock(m_mutex);
         m_cbs.erase(key);
+        m_diffCbs.erase(key);
         SYLAR_LOG_DEBUG(SYLAR_LOG_ROOT()) << getTypeName() << ": An listener has been erased.";
     }
 
@@ -384,17 +745,208 @@ public:
     void clearListener() {
         RWMutexType::WriteLock lock(m_mutex);
         m_cbs.clear();
+        m_diffCbs.clear();
         m_fun_id = 0;
         SYLAR_LOG_DEBUG(SYLAR_LOG_ROOT()) << getTypeName() << ": All listeners have been cleared.";
     }
+
+    bool prepareFromYaml(const YAML::Node& node) override {
+        try {
+            // 同一次事务中重复出现时，后出现的覆盖先出现的
+            m_prepared = std::make_unique<T>(FromNode()(node));
+            return true;
+        }catch(std::exception& e) {
+            SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "ConfigVar::prepareFromYaml exception "
+                << e.what() << " convert: yaml to " << typeid(m_val).name()
+                << " - yaml_val: " << node;
+        }
+        return false;
+    }
+
+    bool prepareFromString(const std::string& val) override {
+        try {
+            m_prepared = std::make_unique<T>(FromStr()(val));
+            return true;
+        }catch(std::exception& e) {
+            SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "ConfigVar::prepareFromString exception "
+                << e.what() << " convert: string to " << typeid(m_val).name()
+                << " - string_val: " << val;
+        }
+        return false;
+    }
+
+    std::string preparedToString() override {
+        if(!m_prepared) {
+            return "";
+        }
+        try {
+            return ToStr()(*m_prepared);
+        }catch(std::exception& e) {
+            SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "ConfigVar::preparedToString exception "
+                << e.what() << " convert: " << typeid(m_val).name() << " to string";
+        }
+        return "";
+    }
+
+    void discardPrepared() override {
+        m_prepared.reset();
+    }
+
+    std::function<void()> commitPrepared() override {
+        if(!m_prepared) {
+            return nullptr;
+        }
+        std::shared_ptr<T> val = std::move(m_prepared);
+        bool async = m_listenerScheduler;
+        bool post = false;
+        {
+            RWMutexType::WriteLock lock(m_mutex);
+            if(*val == m_val) {
+                return nullptr;
+            }
+            // 交换后 val 中保存的是旧值，留给通知函数使用
+            std::swap(m_val, *val);
+            if(async) {
+                // 与 setValue 相同，在写锁内记录
+                post = recordNotify(*val, m_val);
+            }
+        }
+        auto self = std::static_pointer_cast<ConfigVar>(shared_from_this());
+        if(async) {
+            return [self, post]() {
+                if(post) {
+                    self->postNotify();
+                }
+            };
+        }
+        return [self, val]() {
+            self->notifyCommitted(*val);
+        };
+    }
+private:
+    /**
+     * @brief 同步触发 commitPrepared() 产生的变化的回调，新值取调用时的当前值
+     */
+    void notifyCommitted(const T& old_val) {
+        std::unique_ptr<T> new_val;
+        std::map<uint64_t, on_change_cb> cbs;
+        std::map<uint64_t, on_diff_cb> diff_cbs;
+        {
+            // 拷贝一份再调用，回调期间不持有锁，回调里可以再 getValue / setValue
+            RWMutexType::ReadLock lock(m_mutex);
+            new_val = std::make_unique<T>(m_val);
+            cbs = m_cbs;
+            diff_cbs = m_diffCbs;
+        }
+        notifyListeners(cbs, diff_cbs, old_val, *new_val);
+    }
+
+    /**
+     * @brief 调用全部回调，有差异回调时只计算一次差异
+     */
+    static void notifyListeners(const std::map<uint64_t, on_change_cb>& cbs
+            ,const std::map<uint64_t, on_diff_cb>& diff_cbs
+            ,const T& old_val, const T& new_val) {
+        for(auto& i : cbs) {
+            i.second(old_val, new_val);
+        }
+        if constexpr (DiffableContainer<T>) {
+            if(diff_cbs.empty()) {
+                return;
+            }
+            ConfigDiff<T> diff = ConfigDiff<T>::Compute(old_val, new_val);
+            if(diff.empty()) {
+                return;
+            }
+            for(auto& i : diff_cbs) {
+                i.second(diff);
+            }
+        }
+    }
+
+    /**
+     * @brief 记录一次变化，调用时必须持有 m_mutex 的写锁
+     * 已有任务在排队或执行时只更新待通知的新值，由该任务（或它的后继任务）负责通知
+     * @return 需要调用者在释放 m_mutex 后 postNotify
+     */
+    bool recordNotify(const T& old_val, const T& new_val) {
+        Mutex::Lock lock(m_notifyMutex);
+        if(!m_notifyOld) {
+            // 合并时保留最早的旧值
+            m_notifyOld = std::make_unique<T>(old_val);
+        }
+        m_notifyNew = std::make_unique<T>(new_val);
+        if(m_notifyScheduled) {
+            return false;
+        }
+        m_notifyScheduled = true;
+        return true;
+    }
+
+    /**
+     * @brief 投递通知任务，不能持有 m_mutex
+     * 调度器不接受时（已停止，或刚被切回同步模式）在当前线程执行，
+     * 由它清除 m_notifyScheduled，之后的修改照常通知
+     */
+    void postNotify() {
+        auto self = std::static_pointer_cast<ConfigVar>(shared_from_this());
+        if(!dispatchListener([self]() {
+                    self->runAsyncNotify();
+                })) {
+            runAsyncNotify();
+        }
+    }
+
+    /**
+     * @brief 在调度器中执行的通知任务
+     */
+    void runAsyncNotify() {
+        std::unique_ptr<T> old_val;
+        std::unique_ptr<T> new_val;
+        {
+            Mutex::Lock lock(m_notifyMutex);
+            old_val = std::move(m_notifyOld);
+            new_val = std::move(m_notifyNew);
+        }
+        // 合并后可能变回原值（A -> B -> A），此时不通知
+        if(new_val && !(*old_val == *new_val)) {
+            std::map<uint64_t, on_change_cb> cbs;
+            std::map<uint64_t, on_diff_cb> diff_cbs;
+            {
+                RWMutexType::ReadLock lock(m_mutex);
+                cbs = m_cbs;
+                diff_cbs = m_diffCbs;
+            }
+            notifyListeners(cbs, diff_cbs, *old_val, *new_val);
+        }
+
+        {
+            Mutex::Lock lock(m_notifyMutex);
+            if(!m_notifyNew) {
+                m_notifyScheduled = false;
+                return;
+            }
+        }
+        // 执行期间又有新变化，投递后继任务，保持同一配置项的回调串行
+        postNotify();
+    }
 private:
     T m_val;
+    // 事务加载的暂存值，只在 Config 的事务锁内访问
+    std::unique_ptr<T> m_prepared;
+    // 异步通知：待通知的旧值和新值，以及是否已有通知任务在排队或执行
+    Mutex m_notifyMutex;
+    std::unique_ptr<T> m_notifyOld;
+    std::unique_ptr<T> m_notifyNew;
+    bool m_notifyScheduled = false;
     /**
      * @brief 变更回调数组，通过key来确定function
      * 回调函数没有办法比较，即不能直接确定是否为同样的回调函数，固用map而不是用vector来存
      * uint64_t，要求唯一，使用hash确保唯一 
      */
     std::map<uint64_t, on_change_cb> m_cbs;
+    // 差异回调，与 m_cbs 共用 m_fun_id 编号
+    std::map<uint64_t, on_diff_cb> m_diffCbs;
     /**
      * @brief 回调函数的key值
      * 
@@ -430,7 +982,8 @@ public:
             if(it != GetDatas().end()) {
                 auto tmp = std::dynamic_pointer_cast<ConfigVar<T> >(it->second);
                 if(tmp) {
-                    SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "Lookup name=" << name << " exists";
+                    // 重复 Lookup 属于正常用法，降为DEBUG，避免每次查找都格式化一条INFO日志
+                    SYLAR_LOG_DEBUG(SYLAR_LOG_ROOT()) << "Lookup name=" << name << " exists";
                     return tmp;
                 } else {
                     SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "Lookup name=" << name << " exists but type not "
@@ -483,6 +1036,67 @@ public:
      * @param node YAML的Node节点
      */
     static void LoadFromYaml(const YAML::Node& node);
+    /**
+     * @brief 事务式加载多个YAML节点
+     * 1、所有节点先解析到各配置项的暂存区，任意一项失败则整体放弃，当前值不变
+     * 2、全部解析成功后统一提交
+     * 3、所有配置项都提交完成后，释放事务锁，再逐个触发变化配置项的回调，每个配置项每次加载最多触发一次
+     * 4、最后触发一次 reload 回调
+     * 回调和 reload 回调中可以再次加载配置（比如 ConfigWatcher 触发的重新加载），不会死锁。
+     * @attention 提交不是原子的：提交期间其他线程的 getValue 可能看到一部分配置项是新值、一部分还是旧值；
+     *            回调中读到的一定是提交完成后的状态（除非又有新的加载）
+     * 
+     * @param nodes YAML的Node节点，靠后的节点覆盖靠前的同名配置
+     * @return true 提交成功
+     */
+    static bool LoadFromYamls(const std::vector<YAML::Node>& nodes);
+    /**
+     * @brief 事务式加载目录下所有 .yml 文件（按文件名排序）
+     * 
+     * @param path 配置目录
+     * @return true 提交成功
+     */
+    static bool LoadFromConfDir(const std::string& path);
+    /**
+     * @brief 优先从二进制快照加载，快照缺失或过期时回退到 LoadFromConfDir(path)，并重新生成快照
+     * 
+     * @param path 配置目录
+     * @param snapshot_path 快照文件
+     * @return true 加载成功
+     */
+    static bool LoadFromConfDir(const std::string& path, const std::string& snapshot_path);
+    /**
+     * @brief 把 conf_dir 下 .yml 文件中出现的配置项写成二进制快照
+     * 值按 yml 重新解析得到，而不是配置项的当前值：只有代码默认值的配置项、运行时修改过的值都不进快照，
+     * 加载快照时保持原样，与加载 yml 的结果一致。yml 中没有注册的 key 只记录名字。
+     * 同时记录 conf_dir 下每个 .yml 文件的 mtime 和大小，用于判断快照是否过期
+     * 
+     * @attention 类型按本进程注册的配置项记录，应由使用它的同一程序生成
+     * @param path 快照文件
+     * @param conf_dir 快照对应的配置目录
+     * @return true 写入成功
+     */
+    static bool SaveSnapshot(const std::string& path, const std::string& conf_dir);
+    /**
+     * @brief 从二进制快照加载（mmap 读取，跳过 yml 文件的解析）
+     * 以下情况视为快照无效，返回 false 且不修改任何配置项：
+     * 格式或校验和错误；.yml 文件的集合、mtime、大小有变化；
+     * 快照中的 key 现在的注册状态或类型与生成时不同；任意一个值解析失败。
+     * 与 LoadFromYamls 走同一个事务：全部解析成功后统一提交，再触发回调和 reload 回调
+     * 
+     * @param path 快照文件
+     * @param conf_dir 快照对应的配置目录
+     * @return true 加载成功
+     */
+    static bool LoadFromSnapshot(const std::string& path, const std::string& conf_dir);
+    /**
+     * @brief 添加 reload 回调，每次事务加载提交后调用一次
+     * 
+     * @param cb 参数为本次发生变化的配置项名
+     * @return uint64_t 回调的key
+     */
+    static uint64_t AddReloadListener(std::function<void(const std::vector<std::string>&)> cb);
+    static void DelReloadListener(uint64_t key);
     /**
      * @brief 查找配置参数
      * 
@@ -0,0 +1,223 @@
+/**
+ * @file config_key.h
+ * @brief 编译期注册的配置键
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ */
+#ifndef __SYLAR_CONFIG_KEY_H__
+#define __SYLAR_CONFIG_KEY_H__
+
+#include <array>
+#include <bit>
+#include <string_view>
+#include <stdexcept>
+#include "config.h"
+
+namespace sylar {
+
+/**
+ * @brief 可以作为非类型模板参数的字符串字面量(C++20)
+ * 用法：ConfigKey<"system.port", int>，名字直接成为类型的一部分
+ *
+ * @tparam N 字面量长度（包含'\0'）
+ */
+template<size_t N>
+struct FixedString {
+    char data[N] = {};
+
+    consteval FixedString(const char (&str)[N]) {
+        for(size_t i = 0; i < N; ++i) {
+            data[i] = str[i];
+        }
+    }
+
+    constexpr std::string_view view() const { return std::string_view(data, N - 1);}
+};
+
+/**
+ * @brief 编译期校验配置名，与 Config::Lookup 运行时校验的字符集一致
+ * 运行时会先转小写再校验，编译期则直接要求写成小写
+ */
+constexpr bool IsValidConfigName(std::string_view name) {
+    if(name.empty()) {
+        return false;
+    }
+    for(char c : name) {
+        if(!((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9')
+                || c == '.' || c == '_')) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief FNV-1a，seed 用于完美哈希时更换哈希函数
+ */
+constexpr uint64_t ConfigNameHash(std::string_view name, uint64_t seed = 0) {
+    uint64_t h = 0xcbf29ce484222325ULL ^ (seed * 0x9e3779b97f4a7c15ULL);
+    for(char c : name) {
+        h ^= static_cast<uint8_t>(c);
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+/**
+ * @brief 编译期声明的配置键，名字和类型都在编译期确定
+ *
+ * 与 Config::Lookup<T>(name) 相比：
+ * 1、名字是否合法由 static_assert 检查，写错直接编译失败
+ * 2、Get() 直接返回该键专属的静态变量，没有 map 查找、字符串比较、dynamic_pointer_cast，也不加锁
+ *
+ * 仍然通过 Config::Lookup 注册到全局 map 中，因此 LoadFromYaml、Visit 等运行时接口不受影响
+ *
+ * @attention Define() 应在全局静态变量初始化时调用，线程启动之后只读 Get()
+ *
+ * @tparam Name 配置名
+ * @tparam T 配置类型
+ */
+template<FixedString Name, class T>
+class ConfigKey {
+public:
+    static_assert(IsValidConfigName(Name.view()), "ConfigKey name invalid");
+
+    typedef T value_type;
+    typedef typename ConfigVar<T>::ptr VarPtr;
+
+    static constexpr std::string_view name = Name.view();
+    static constexpr uint64_t hash = ConfigNameHash(name);
+
+    /**
+     * @brief 注册配置项，相当于 Config::Lookup(name, default_val, description)
+     *
+     * @exception std::invalid_argument 同名配置项已存在且类型不同
+     */
+    static const VarPtr& Define(const T& default_val, const std::string& description = "") {
+        VarPtr var = Config::Lookup<T>(std::string(name), default_val, description);
+        if(!var) {
+            throw std::invalid_argument(std::string(name));
+        }
+        s_var = var;
+        return s_var;
+    }
+
+    /**
+     * @brief 获取配置项，未 Define 时返回nullptr
+     */
+    static const VarPtr& Get() { return s_var;}
+
+    static ConfigVarBase::ptr GetBase() { return s_var;}
+private:
+    static inline VarPtr s_var;
+};
+
+/**
+ * @brief 把一组 ConfigKey 收集成一张编译期完美哈希表
+ *
+ * 编译期：检查重名，搜索一个 seed 使所有键落在不同的槽中
+ * 运行时：IndexOf<Key>() 是常量；Find(name) 只需一次哈希和一次比较（用于拒绝表外的名字）
+ *
+ * @example
+ * using ServerSchema = sylar::ConfigSchema<PortKey, TimeoutKey>;
+ * ServerSchema::Find("system.port");
+ */
+template<class... Keys>
+class ConfigSchema {
+public:
+    static constexpr size_t size = sizeof...(Keys);
+    // 槽数取大于 2 倍键数的 2 的幂，便于用 & 代替 %，也更容易找到无冲突的 seed
+    static constexpr size_t table_size = std::bit_ceil(size * 2 + 1);
+    static constexpr std::array<std::string_view, size> names = { Keys::name... };
+
+private:
+    static constexpr bool HasDuplicate() {
+        for(size_t i = 0; i < size; ++i) {
+            for(size_t j = i + 1; j < size; ++j) {
+                if(names[i] == names[j]) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    static constexpr bool TryBuild(uint64_t seed, std::array<int, table_size>& table) {
+        for(auto& i : table) {
+            i = -1;
+        }
+        for(size_t i = 0; i < size; ++i) {
+            size_t slot = ConfigNameHash(names[i], seed) & (table_size - 1);
+            if(table[slot] != -1) {
+                return false;
+            }
+            table[slot] = i;
+        }
+        return true;
+    }
+
+    static constexpr uint64_t FindSeed() {
+        std::array<int, table_size> table {};
+        for(uint64_t seed = 0; seed < 100000; ++seed) {
+            if(TryBuild(seed, table)) {
+                return seed;
+            }
+        }
+        // 找不到时在编译期报错（consteval 上下文中 throw 不是常量表达式）
+        throw std::logic_error("ConfigSchema seed not found");
+    }
+
+    static constexpr std::array<int, table_size> BuildTable() {
+        std::array<int, table_size> table {};
+        TryBuild(seed, table);
+        return table;
+    }
+
+    template<class Key, size_t I, class First, class... Rest>
+    static constexpr size_t IndexOfImpl() {
+        if constexpr (std::is_same_v<Key, First>) {
+            return I;
+        } else {
+            static_assert(sizeof...(Rest) > 0, "Key not in ConfigSchema");
+            return IndexOfImpl<Key, I + 1, Rest...>();
+        }
+    }
+
+public:
+    static_assert(size > 0, "ConfigSchema is empty");
+    static_assert(!HasDuplicate(), "ConfigSchema has duplicate names");
+
+    static constexpr uint64_t seed = FindSeed();
+    // 槽 -> Keys 中的下标，-1 为空槽
+    static constexpr std::array<int, table_size> table = BuildTable();
+
+    /**
+     * @brief 键在表中的下标，编译期求值
+     */
+    template<class Key>
+    static constexpr size_t IndexOf() {
+        return IndexOfImpl<Key, 0, Keys...>();
+    }
+
+    /**
+     * @brief 按名字查找对应键的下标，不存在返回-1
+     */
+    static constexpr int IndexOf(std::string_view name) {
+        int idx = table[ConfigNameHash(name, seed) & (table_size - 1)];
+        return (idx != -1 && names[idx] == name) ? idx : -1;
+    }
+
+    /**
+     * @brief 按名字获取配置项，不经过全局 map 和读写锁
+     */
+    static ConfigVarBase::ptr Find(std::string_view name) {
+        static constexpr std::array<ConfigVarBase::ptr (*)(), size> getters = { &Keys::GetBase... };
+        int idx = IndexOf(name);
+        return idx == -1 ? nullptr : getters[idx]();
+    }
+};
+
+}
+
+#endif
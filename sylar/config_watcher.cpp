@@ -0,0 +1,157 @@
+/**
+ * @file config_watcher.cpp
+ * @brief 配置目录监听实现
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ */
+#include "config_watcher.h"
+#include "config.h"
+#include "log.h"
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <string.h>
+#include <errno.h>
+
+namespace sylar {
+
+static Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+ConfigWatcher::ConfigWatcher(const std::string& path, uint32_t debounce_ms)
+    :m_path(path)
+    ,m_debounceMs(debounce_ms) {
+}
+
+ConfigWatcher::~ConfigWatcher() {
+    stop();
+}
+
+bool ConfigWatcher::start() {
+    if(!m_stopping) {
+        return true;
+    }
+    m_inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(m_inotifyFd < 0) {
+        SYLAR_LOG_ERROR(g_logger) << "inotify_init1 fail, errno=" << errno
+            << " " << strerror(errno);
+        return false;
+    }
+    // 写完关闭、mv 覆盖（原子发布）、删除都需要重新加载
+    if(inotify_add_watch(m_inotifyFd, m_path.c_str(),
+                IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE) < 0) {
+        SYLAR_LOG_ERROR(g_logger) << "inotify_add_watch fail, path=" << m_path
+            << " errno=" << errno << " " << strerror(errno);
+        close(m_inotifyFd);
+        m_inotifyFd = -1;
+        return false;
+    }
+    m_wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(m_wakeFd < 0) {
+        SYLAR_LOG_ERROR(g_logger) << "eventfd fail, errno=" << errno
+            << " " << strerror(errno);
+        close(m_inotifyFd);
+        m_inotifyFd = -1;
+        return false;
+    }
+    m_stopping = false;
+    m_thread = std::make_shared<Thread>(std::bind(&ConfigWatcher::run, this), "config_watcher");
+    return true;
+}
+
+void ConfigWatcher::stop() {
+    if(m_stopping.exchange(true)) {
+        return;
+    }
+    uint64_t one = 1;
+    if(write(m_wakeFd, &one, sizeof(one)) != sizeof(one)) {
+        SYLAR_LOG_ERROR(g_logger) << "ConfigWatcher wake fail, errno=" << errno;
+    }
+    if(m_thread) {
+        m_thread->join();
+        m_thread.reset();
+    }
+    close(m_wakeFd);
+    close(m_inotifyFd);
+    m_wakeFd = -1;
+    m_inotifyFd = -1;
+}
+
+bool ConfigWatcher::drain() {
+    // inotify_event 后面跟着变长的文件名，按 inotify(7) 的建议对齐缓冲区
+    alignas(struct inotify_event) char buf[4096];
+    bool relevant = false;
+    while(true) {
+        ssize_t len = read(m_inotifyFd, buf, sizeof(buf));
+        if(len <= 0) {
+            break;
+        }
+        for(char* p = buf; p < buf + len; ) {
+            struct inotify_event* ev = (struct inotify_event*)p;
+            if(ev->len > 0) {
+                size_t n = strlen(ev->name);
+                if(n > 4 && strcmp(ev->name + n - 4, ".yml") == 0) {
+                    relevant = true;
+                }
+            }
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+    return relevant;
+}
+
+void ConfigWatcher::run() {
+    SYLAR_LOG_INFO(g_logger) << "ConfigWatcher start, path=" << m_path;
+    struct pollfd fds[2];
+    fds[0].fd = m_inotifyFd;
+    fds[0].events = POLLIN;
+    fds[1].fd = m_wakeFd;
+    fds[1].events = POLLIN;
+
+    while(!m_stopping) {
+        int rt = poll(fds, 2, -1);
+        if(rt < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            SYLAR_LOG_ERROR(g_logger) << "ConfigWatcher poll fail, errno=" << errno;
+            break;
+        }
+        if(fds[1].revents & POLLIN) {
+            break;
+        }
+        if(!drain()) {
+            continue;
+        }
+        // 防抖：一直等到 debounce_ms 内没有新事件
+        bool stopped = false;
+        while(true) {
+            rt = poll(fds, 2, m_debounceMs);
+            if(rt == 0) {
+                break;
+            }
+            if(rt < 0) {
+                if(errno == EINTR) {
+                    // revents 还是上一次 poll 的结果，不能再看
+                    continue;
+                }
+                break;
+            }
+            if(fds[1].revents & POLLIN) {
+                stopped = true;
+                break;
+            }
+            drain();
+        }
+        if(stopped) {
+            break;
+        }
+        bool ok = Config::LoadFromConfDir(m_path);
+        ++m_reloadCount;
+        SYLAR_LOG_INFO(g_logger) << "ConfigWatcher reload " << (ok ? "commit" : "rollback")
+            << ", path=" << m_path;
+    }
+    SYLAR_LOG_INFO(g_logger) << "ConfigWatcher stop, path=" << m_path;
+}
+
+}
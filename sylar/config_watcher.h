@@ -0,0 +1,80 @@
+/**
+ * @file config_watcher.h
+ * @brief 配置目录监听，文件变化后自动事务式重新加载
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ */
+#ifndef __SYLAR_CONFIG_WATCHER_H__
+#define __SYLAR_CONFIG_WATCHER_H__
+
+#include <memory>
+#include <string>
+#include <atomic>
+#include "thread.h"
+
+namespace sylar {
+
+/**
+ * @brief 用 inotify 监听配置目录下的 *.yml
+ *
+ * 1、独立线程等待 inotify 事件，解析和回调都在这个线程中执行，不占用业务线程
+ * 2、防抖：收到事件后，直到连续 debounce_ms 内没有新事件才开始加载，
+ *    编辑器保存、批量发布时的一连串事件只触发一次加载
+ * 3、通过 Config::LoadFromConfDir 事务式加载：全部解析成功才提交，回调看到的是一致的新状态
+ */
+class ConfigWatcher {
+public:
+    typedef std::shared_ptr<ConfigWatcher> ptr;
+
+    /**
+     * @brief 构造，仅进行参数配置，需要start()
+     *
+     * @param path 配置目录，如 bin/conf
+     * @param debounce_ms 防抖时间（毫秒）
+     */
+    ConfigWatcher(const std::string& path, uint32_t debounce_ms = 200);
+    ~ConfigWatcher();
+
+    /**
+     * @brief 开始监听
+     *
+     * @return true 成功
+     * @return false inotify 初始化或添加监听失败
+     */
+    bool start();
+    /**
+     * @brief 停止监听并等待线程退出
+     */
+    void stop();
+
+    const std::string& getPath() const { return m_path;}
+    /**
+     * @brief 已完成（提交或回滚）的加载次数
+     */
+    uint64_t getReloadCount() const { return m_reloadCount;}
+private:
+    ConfigWatcher(const ConfigWatcher&) = delete;
+    ConfigWatcher& operator=(const ConfigWatcher&) = delete;
+
+    void run();
+    /**
+     * @brief 读空 inotify 中的事件
+     *
+     * @return true 其中有 .yml 文件的事件
+     */
+    bool drain();
+private:
+    std::string m_path;
+    uint32_t m_debounceMs;
+    int m_inotifyFd = -1;
+    // eventfd，用于 stop() 唤醒阻塞在 poll 中的线程
+    int m_wakeFd = -1;
+    Thread::ptr m_thread;
+    std::atomic<bool> m_stopping{true};
+    std::atomic<uint64_t> m_reloadCount{0};
+};
+
+}
+
+#endif
@@ -6,11 +6,18 @@
  * 
  */
 #include <atomic>
+#include <map>
+#include <string.h>
+#include <cxxabi.h>
 #include "fiber.h"
+#include "fiber_local.h"
+#include "fiber_trace.h"
 #include "log.h"
 #include "config.h"
+#include "config_key.h"
 #include "macor.h"
 #include "scheduler.h"
+#include "stack_allocator.h"
 
 namespace sylar {
 
@@ -24,24 +31,122 @@ static thread_local Fiber* t_scheduler_fiber = nullptr;
 // 线程的主协程
 static thread_local Fiber::ptr t_threadFiber = nullptr;
 
+// 名字在编译期校验
 static ConfigVar<uint32_t>::ptr g_fiber_stack_size = 
-    Config::Lookup<uint32_t>("fiber.stack_size", 1024*1024, "fiber stack size");
+    ConfigKey<"fiber.stack_size", uint32_t>::Define(1024*1024, "fiber stack size");
+static ConfigVar<uint32_t>::ptr g_fiber_shared_stack_size =
+    ConfigKey<"fiber.shared_stack_size", uint32_t>::Define(1024*1024, "per thread shared stack size");
+static ConfigVar<bool>::ptr g_fiber_stack_check =
+    ConfigKey<"fiber.stack_check", bool>::Define(false, "paint fiber stacks, check canary and record stack high-water mark (0/1)");
+
+// 栈检查开关，创建协程时读取，只对之后创建的协程生效
+static std::atomic<bool> s_stack_check{false};
+
+struct FiberIniter {
+    FiberIniter() {
+        s_stack_check = g_fiber_stack_check->getValue();
+        g_fiber_stack_check->addListener([](const bool&, const bool& new_value) {
+            s_stack_check = new_value;
+        });
+    }
+};
+
+static FiberIniter __fiber_init;
 
-// 统一接口
-class MallocStackAllocator {
-public:
-    static void* Alloc(size_t size) {
-        return malloc(size);
+// 栈的填充图案；栈向下增长，栈底（低地址）的几个字作为金丝雀
+static constexpr uint64_t STACK_PAINT = 0xA5A5A5A5A5A5A5A5ULL;
+static constexpr size_t STACK_CANARY_WORDS = 8;
+
+static void PaintStack(char* begin, char* end) {
+    uint64_t* p = (uint64_t*)begin;
+    uint64_t* e = (uint64_t*)end;
+    while(p < e) {
+        *p++ = STACK_PAINT;
     }
+}
 
-    // 为了以后便于添加新的allocator，故保留size参数
-    static void Dealloc(void* vp, size_t size) {
-        return free(vp);
+static std::string DemangleName(const char* name) {
+    if(!name) {
+        return "unknown";
     }
+    int status = 0;
+    char* demangled = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+    if(status != 0 || !demangled) {
+        return name;
+    }
+    std::string rt = demangled;
+    free(demangled);
+    return rt;
+}
+
+/**
+ * @brief 栈使用统计，只在打开 fiber.stack_check 时、协程结束时访问
+ * 故意泄漏，避免静态析构之后结束的协程访问已析构的对象
+ */
+struct StackStatsTable {
+    Mutex mutex;
+    std::map<std::string, Fiber::StackStats> stats;
 };
 
-// 统一类型名，便于维护
-using StackAllocator = MallocStackAllocator;
+static StackStatsTable& GetStackStatsTable() {
+    static StackStatsTable* s_table = new StackStatsTable;
+    return *s_table;
+}
+
+/**
+ * @brief 线程的共享栈，第一次有共享栈协程运行时才分配
+ */
+struct SharedStack {
+    void* stack = nullptr;
+    size_t size = 0;
+    StackAllocator* allocator = nullptr;
+    /**
+     * 当前占用共享栈、栈内容还没保存的协程。不持有引用：
+     * 占用者结束时在本线程上（LeaveSharedStack）清空，没结束的协程不能析构，
+     * 所以这里总是指向活着的协程，线程退出时也不会在 TLS 析构中析构协程
+     */
+    Fiber* occupant = nullptr;
+
+    ~SharedStack() {
+        if(stack) {
+            allocator->dealloc(stack, size);
+        }
+    }
+};
+
+static thread_local SharedStack t_shared_stack;
+
+/**
+ * @brief 共享栈协程结束时调用（仍在共享栈上运行），之后栈上没有需要保存的内容
+ */
+static void LeaveSharedStack(Fiber* fiber) {
+    if(t_shared_stack.occupant == fiber) {
+        t_shared_stack.occupant = nullptr;
+    }
+}
+
+// YieldToPark 留给切换目标执行的回调
+static thread_local void (*t_park_cb)(void*) = nullptr;
+static thread_local void* t_park_arg = nullptr;
+
+/**
+ * @brief 切回调度协程（或线程主协程）之后执行挂起者留下的回调
+ */
+static void RunParkCallback() {
+    if(t_park_cb) {
+        auto cb = t_park_cb;
+        t_park_cb = nullptr;
+        cb(t_park_arg);
+    }
+}
+
+/**
+ * @brief 切换的目标：有调度器时为调度协程，否则为线程的主协程
+ */
+static Fiber* GetSwitchTarget() {
+    Fiber* target = Scheduler::GetMainFiber();
+    return target ? target : t_threadFiber.get();
+}
 
 Fiber::Fiber() {
     // 每个线程都有一个mainFiber，且id == 0
@@ -49,53 +154,70 @@ Fiber::Fiber() {
     m_state = EXEC;
     SetThis(this);
 
-    // 获取上下文
-    if(getcontext(&m_ctx)) {
-        SYLAR_ASSERT2(false, "getcontext");
-    }
+    // 主协程使用线程原本的栈，上下文在第一次切出时保存，这里不需要初始化
 
     SYLAR_LOG_DEBUG(g_logger) << "Fiber::Fiber mainFiber";
 }
 
-Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool isBackToCaller) 
+Fiber::Fiber(Callback cb, size_t stacksize, bool isBackToCaller, bool sharedStack) 
     :m_id(++s_fiber_id)
-    ,m_cb(cb) {
+    ,m_cb(std::move(cb)) {
     ++s_fiber_count;
+    if(sharedStack) {
+        SYLAR_ASSERT2(!isBackToCaller, "caller fiber can not use shared stack");
+#if SYLAR_FIBER_CONTEXT_ASM
+        // 不分配栈，上下文在第一次切入、占用共享栈之后才构造
+        m_shared = true;
+        FiberTrace::Record(FiberTrace::CREATE, m_id);
+        SYLAR_LOG_DEBUG(g_logger) << "Fiber::Fiber shared stack id = " << m_id;
+        return;
+#else
+        SYLAR_LOG_WARN(g_logger) << "shared stack fiber needs asm fiber context, use private stack";
+#endif
+    }
     m_stacksize = stacksize ? stacksize : g_fiber_stack_size->getValue();
 
-    m_stack = StackAllocator::Alloc(m_stacksize);
-    if(getcontext(&m_ctx)) {
-        SYLAR_ASSERT2(false, "getcontext");
+    // 记下分配器，析构时归还给同一个分配器
+    m_allocator = StackAllocator::GetDefault();
+    m_stack = m_allocator->alloc(m_stacksize);
+    if(s_stack_check) {
+        // 整个栈都会被写一遍，mmap 模式下失去按需提交的效果，只用于测量
+        m_stackCheck = true;
+        m_entry = m_cb.target_type().name();
+        PaintStack((char*)m_stack, (char*)m_stack + m_stacksize);
     }
-    // un_link是当前上下文结束后返回的上下文，为nullptr不绑定任何上下文
-    // nullptr确保是显示调度，任何 Fiber 切换，都必须显式走调度器
-    m_ctx.uc_link = nullptr;
-    // 绑定分配的栈空间
+    // 绑定分配的栈空间，入口函数结束后不会自动返回任何上下文，
+    // 任何 Fiber 切换，都必须显式走调度器
     /**
      * 栈空间会保存其执行函数中的局部变量
      * 因此若其中有用到智能指针，需要手动释放
      * 不然计数永远+1，无法自动析构，同时反过来导致调用栈无法被释放，造成内存泄露（类似死锁）
      * 
      */
-    m_ctx.uc_stack.ss_sp = m_stack;
-    m_ctx.uc_stack.ss_size = m_stacksize;
     if(isBackToCaller) {
-        makecontext(&m_ctx, &Fiber::CallerMainFunc, 0);
+        MakeFiberContext(&m_ctx, m_stack, m_stacksize, &Fiber::CallerMainFunc);
     } else {
-        // 指定入口函数，真正切换用swapcontext
-        makecontext(&m_ctx, &Fiber::MainFunc, 0);
+        // 指定入口函数，真正切换用SwapFiberContext
+        MakeFiberContext(&m_ctx, m_stack, m_stacksize, &Fiber::MainFunc);
     }
+    FiberTrace::Record(FiberTrace::CREATE, m_id);
 
     SYLAR_LOG_DEBUG(g_logger) << "Fiber::Fiber id = " << m_id;
 }
 
 Fiber::~Fiber() {
     --s_fiber_count;
+    // 主协程以及没运行完的协程，局部变量在这里销毁
+    clearLocals();
+    if(m_shared) {
+        SYLAR_ASSERT(m_state == INIT || m_state == EXCEPT || m_state == TERM);
+        free(m_savedStack);
+    }
     // 主协程没有栈空间 m_stack == nullptr
-    if(m_stack) {
+    else if(m_stack) {
         // 有栈的情况下，协程状态要么状态是刚初始化，要么是结束了
         SYLAR_ASSERT(m_state == INIT || m_state == EXCEPT || m_state == TERM);
-        StackAllocator::Dealloc(m_stack, m_stacksize);
+        m_allocator->dealloc(m_stack, m_stacksize);
     }
     else {
         // 此时为主协程，没有callback函数且状态为EXEC
@@ -110,62 +232,241 @@ Fiber::~Fiber() {
     SYLAR_LOG_DEBUG(g_logger) << "Fiber::~Fiber id = " << m_id;
 }
 
-void Fiber::reset(std::function<void()> cb) {
+void Fiber::reset(Callback cb) {
     // 有栈且状态对的协程才能重置
-    SYLAR_ASSERT(m_stack);
+    SYLAR_ASSERT(m_stack || m_shared);
     // 协程只有在EXCEPT和TERM、INIT状态下才允许重置
     SYLAR_ASSERT(m_state == EXCEPT || m_state == TERM || m_state == INIT);
+    // 上一个任务的协程局部变量和取消令牌不能带到下一个任务
+    clearLocals();
+    m_cancel.reset();
+    m_affinity = AFFINITY_FREE;
+    m_lastThread = -1;
     // 转移cb
     m_cb = std::move(cb);
+    if(m_cb) {
+        // 从协程池取出，相当于新建
+        FiberTrace::Record(FiberTrace::CREATE, m_id);
+    }
 
-    // 下面与构造函数基本相同
-    if(getcontext(&m_ctx)) {
-        SYLAR_ASSERT2(false, "getcontext");
+    if(m_shared) {
+        // 旧的栈内容作废，下次切入时重新构造上下文，也不再固定线程
+        m_savedSize = 0;
+        m_sharedThread = -1;
+        m_state = INIT;
+        return;
     }
-    m_ctx.uc_link = nullptr;
-    makecontext(&m_ctx, &Fiber::MainFunc, 0);
+
+    if(m_stackCheck) {
+        // 上次运行只弄脏了栈顶 m_stackUsed 这一段
+        char* top = (char*)m_stack + m_stacksize;
+        PaintStack(top - m_stackUsed, top);
+        m_stackUsed = 0;
+        m_entry = m_cb.target_type().name();
+    }
+
+    // 下面与构造函数基本相同
+    MakeFiberContext(&m_ctx, m_stack, m_stacksize, &Fiber::MainFunc);
 
     m_state = INIT;
 }
 
 void Fiber::swapIn() {
-    SetThis(this);
     // 必定不在运行态
     SYLAR_ASSERT(m_state != EXEC);
+    if(m_shared) {
+        takeSharedStack();
+    }
+    SetThis(this);
     m_state = EXEC;
+    FiberTrace::Record(FiberTrace::SWAP_IN, m_id);
     
     // SYLAR_LOG_INFO(g_logger) << "从调度协程切入协程";
-    // swapcontext(&old_context, &new_context)将当前状态保存到old_context中，切换到new_context
-    if(swapcontext(&(Scheduler::GetMainFiber()->m_ctx), &m_ctx)) {
-        SYLAR_ASSERT2(false, "swapcontext error");
-    }
-    
+    // SwapFiberContext(&old_context, &new_context)将当前状态保存到old_context中，切换到new_context
+    SwapFiberContext(&(GetSwitchTarget()->m_ctx), &m_ctx);
+    RunParkCallback();
 }
 
 void Fiber::swapOut() {
     // SYLAR_LOG_INFO(g_logger) << "切回调度协程";
-    // 切回调度协程
-    SetThis(Scheduler::GetMainFiber());
-    if(swapcontext(&m_ctx, &(Scheduler::GetMainFiber()->m_ctx))) {
-        SYLAR_ASSERT2(false, "swapcontext error");
+    if(m_stackCheck) {
+        checkStackCanary();
     }
+    FiberTrace::Record(FiberTrace::SWAP_OUT, m_id);
+    // 切回调度协程
+    Fiber* target = GetSwitchTarget();
+    SetThis(target);
+    SwapFiberContext(&m_ctx, &target->m_ctx);
 }
 
 void Fiber::call() {
-    SetThis(this);
     SYLAR_ASSERT(m_state != EXEC);
-    m_state = EXEC;
-    if(swapcontext(&t_threadFiber->m_ctx, &m_ctx)) {
-        SYLAR_ASSERT2(false, "swapcontext error");
+    if(m_shared) {
+        takeSharedStack();
     }
+    SetThis(this);
+    m_state = EXEC;
+    SwapFiberContext(&t_threadFiber->m_ctx, &m_ctx);
+    RunParkCallback();
 }
 
 
 void Fiber::back() {
+    if(m_stackCheck) {
+        checkStackCanary();
+    }
     SetThis(t_threadFiber.get());
-    if(swapcontext(&m_ctx, &t_threadFiber->m_ctx)) {
-        SYLAR_ASSERT2(false, "swapcontext error");
+    SwapFiberContext(&m_ctx, &t_threadFiber->m_ctx);
+}
+
+void Fiber::setLocal(uint32_t index, void* val) {
+    if(val) {
+        m_hasLocals = true;
+    }
+    if(index < LOCAL_INLINE_SLOTS) {
+        m_locals[index] = val;
+        return;
+    }
+    index -= LOCAL_INLINE_SLOTS;
+    if(index >= m_localSpill.size()) {
+        if(!val) {
+            return;
+        }
+        m_localSpill.resize(index + 1, nullptr);
+    }
+    m_localSpill[index] = val;
+}
+
+void Fiber::clearLocals() {
+    // 析构函数里可能再次访问协程局部变量，每轮先取出再销毁，直到没有新的值
+    while(m_hasLocals) {
+        m_hasLocals = false;
+        for(uint32_t i = 0; i < LOCAL_INLINE_SLOTS; ++i) {
+            if(void* vp = m_locals[i]) {
+                m_locals[i] = nullptr;
+                FiberLocalRegistry::GetDeleter(i)(vp);
+            }
+        }
+        for(size_t i = 0; i < m_localSpill.size(); ++i) {
+            if(void* vp = m_localSpill[i]) {
+                m_localSpill[i] = nullptr;
+                FiberLocalRegistry::GetDeleter(i + LOCAL_INLINE_SLOTS)(vp);
+            }
+        }
+    }
+}
+
+void Fiber::checkStackCanary() {
+    const uint64_t* p = (const uint64_t*)m_stack;
+    for(size_t i = 0; i < STACK_CANARY_WORDS; ++i) {
+        if(SYLAR_UNLIKELY(p[i] != STACK_PAINT)) {
+            // 栈已经越界，继续运行只会破坏更多内存
+            SYLAR_LOG_ERROR(g_logger) << "fiber stack overflow fiber_id=" << m_id
+                << " stack_size=" << m_stacksize
+                << " entry=" << DemangleName(m_entry);
+            SYLAR_ASSERT2(false, "fiber stack overflow");
+        }
+    }
+}
+
+void Fiber::recordStackUsage() {
+    // 从栈底向上找到第一个被改写的字，以上就是用到过的栈
+    const uint64_t* p = (const uint64_t*)m_stack;
+    const uint64_t* end = (const uint64_t*)((char*)m_stack + m_stacksize);
+    while(p < end && *p == STACK_PAINT) {
+        ++p;
     }
+    m_stackUsed = (const char*)end - (const char*)p;
+
+    StackStatsTable& table = GetStackStatsTable();
+    Mutex::Lock lock(table.mutex);
+    StackStats& st = table.stats[m_entry ? m_entry : ""];
+    ++st.count;
+    st.stack_size = m_stacksize;
+    st.max_used = std::max(st.max_used, m_stackUsed);
+    st.total_used += m_stackUsed;
+}
+
+std::vector<Fiber::StackStats> Fiber::GetStackStats() {
+    StackStatsTable& table = GetStackStatsTable();
+    std::vector<StackStats> rt;
+    {
+        Mutex::Lock lock(table.mutex);
+        for(auto& i : table.stats) {
+            rt.push_back(i.second);
+            rt.back().entry = i.first;
+        }
+    }
+    for(auto& i : rt) {
+        i.entry = DemangleName(i.entry.empty() ? nullptr : i.entry.c_str());
+    }
+    return rt;
+}
+
+void Fiber::ResetStackStats() {
+    StackStatsTable& table = GetStackStatsTable();
+    Mutex::Lock lock(table.mutex);
+    table.stats.clear();
+}
+
+void Fiber::takeSharedStack() {
+#if SYLAR_FIBER_CONTEXT_ASM
+    // 拷贝共享栈时不能正运行在共享栈上
+    SYLAR_ASSERT2(!t_scheduler_fiber || !t_scheduler_fiber->m_shared
+            , "switch to shared stack fiber from shared stack fiber");
+    pid_t tid = GetThreadId();
+    if(m_sharedThread == -1) {
+        m_sharedThread = tid;
+    } else {
+        SYLAR_ASSERT2(m_sharedThread == tid, "shared stack fiber resumed on another thread, fiber_id="
+                << m_id << " thread=" << m_sharedThread);
+    }
+
+    SharedStack& ss = t_shared_stack;
+    if(!ss.stack) {
+        ss.size = g_fiber_shared_stack_size->getValue();
+        ss.allocator = StackAllocator::GetDefault();
+        ss.stack = ss.allocator->alloc(ss.size);
+    }
+    char* top = (char*)ss.stack + ss.size;
+    Fiber* occupant = ss.occupant;
+    if(occupant != this) {
+        // 已结束或还没运行过的占用者，栈上没有需要保留的内容
+        if(occupant && occupant->m_state != INIT
+                && occupant->m_state != TERM && occupant->m_state != EXCEPT) {
+            occupant->saveSharedStack(top);
+        }
+        ss.occupant = this;
+        if(m_state != INIT) {
+            SYLAR_ASSERT((char*)m_ctx.sp == top - m_savedSize);
+            memcpy(top - m_savedSize, m_savedStack, m_savedSize);
+        }
+    }
+    if(m_state == INIT) {
+        MakeFiberContext(&m_ctx, ss.stack, ss.size, &Fiber::MainFunc);
+    }
+#else
+    SYLAR_ASSERT2(false, "shared stack fiber needs asm fiber context");
+#endif
+}
+
+void Fiber::saveSharedStack(char* top) {
+#if SYLAR_FIBER_CONTEXT_ASM
+    // 切出时保存的栈指针以上就是实际用到的栈
+    size_t used = top - (char*)m_ctx.sp;
+    // 按实际大小分配，明显变浅时缩小
+    if(used > m_savedCapacity || used < m_savedCapacity / 4) {
+        free(m_savedStack);
+        m_savedStack = (char*)malloc(used);
+        if(!m_savedStack) {
+            m_savedCapacity = 0;
+            throw std::bad_alloc();
+        }
+        m_savedCapacity = used;
+    }
+    memcpy(m_savedStack, m_ctx.sp, used);
+    m_savedSize = used;
+#endif
 }
 
 /**
@@ -195,6 +496,13 @@ Fiber::ptr Fiber::GetThis() {
     return t_scheduler_fiber->shared_from_this();
 }
 
+Fiber* Fiber::GetThisPtr() {
+    if(SYLAR_LIKELY(t_scheduler_fiber)) {
+        return t_scheduler_fiber;
+    }
+    return GetThis().get();
+}
+
 void Fiber::SetThis(Fiber* fiber) {
     t_scheduler_fiber = fiber;
 }
@@ -206,10 +514,85 @@ uint64_t Fiber::GetFiberId() {
     return 0;
 }
 
+CancellationToken::ptr Fiber::GetCancellationTokenOfThis() {
+    Fiber* cur = t_scheduler_fiber;
+    return cur ? cur->m_cancel : nullptr;
+}
+
+bool Fiber::IsCancelled() {
+    Fiber* cur = t_scheduler_fiber;
+    return cur && cur->m_cancel && cur->m_cancel->isCancelled();
+}
+
+void Fiber::CheckCancel() {
+    if(SYLAR_UNLIKELY(IsCancelled())) {
+        throw CancelledError();
+    }
+}
+
 void Fiber::YieldToReady() {
     Fiber::ptr cur = GetThis();
     SYLAR_ASSERT(cur->m_state == EXEC);
     cur->m_state = READY;
+    FiberTrace::Record(FiberTrace::YIELD, cur->m_id);
+    cur->swapOut();
+    if(SYLAR_UNLIKELY(cur->m_cancel) && cur->m_cancel->isCancelled()) {
+        throw CancelledError();
+    }
+}
+
+void Fiber::YieldTo(Fiber::ptr target) {
+    Fiber* cur = t_scheduler_fiber;
+    SYLAR_ASSERT(cur && cur->m_state == EXEC);
+    SYLAR_ASSERT2(cur != GetSwitchTarget() && cur != t_threadFiber.get()
+            , "YieldTo must be called in a sub fiber");
+    SYLAR_ASSERT(target && target.get() != cur);
+    SYLAR_ASSERT(target->m_state == INIT || target->m_state == READY);
+
+    pid_t pinned = target->getPinnedThread();
+    if((cur->m_shared && target->m_shared)
+            || (pinned != -1 && pinned != GetThreadId())) {
+        // 正运行在共享栈上，不能切换共享栈的占用者；或 target 只能在其他线程恢复。交给调度器
+        Scheduler* sc = Scheduler::GetThis();
+        SYLAR_ASSERT2(sc, "YieldTo between shared stack fibers or to a pinned fiber needs a scheduler");
+        sc->scheduleHandoff(std::move(target));
+        YieldToReady();
+        return;
+    }
+
+    if(cur->m_stackCheck) {
+        cur->checkStackCanary();
+    }
+    if(target->m_shared) {
+        target->takeSharedStack();
+    }
+    cur->m_state = READY;
+    target->m_state = EXEC;
+    if(cur->m_lastThread != -1) {
+        // 不经过调度器，替它记录 target 运行的线程
+        target->m_lastThread = cur->m_lastThread;
+    }
+    if(SYLAR_UNLIKELY(FiberTrace::IsEnabled())) {
+        FiberTrace::Record(FiberTrace::YIELD, cur->m_id);
+        FiberTrace::Record(FiberTrace::SWAP_OUT, cur->m_id);
+        FiberTrace::Record(FiberTrace::SWAP_IN, target->m_id);
+    }
+    SetThis(target.get());
+    // target 的引用留在当前协程的栈上，直到当前协程被切回
+    SwapFiberContext(&cur->m_ctx, &target->m_ctx);
+    if(SYLAR_UNLIKELY(cur->m_cancel) && cur->m_cancel->isCancelled()) {
+        throw CancelledError();
+    }
+}
+
+void Fiber::YieldToPark(void (*after)(void* arg), void* arg) {
+    Fiber* cur = t_scheduler_fiber;
+    SYLAR_ASSERT(cur && cur->m_state == EXEC);
+    SYLAR_ASSERT2(cur != GetSwitchTarget() && cur != t_threadFiber.get()
+            , "YieldToPark must be called in a sub fiber");
+    t_park_cb = after;
+    t_park_arg = arg;
+    cur->m_state = READY;
     cur->swapOut();
 }
 
@@ -225,6 +608,13 @@ void Fiber::MainFunc() {
         cur->m_cb = nullptr;
         cur->m_state = TERM;
     }
+    catch(const CancelledError& e) {
+        // 被取消是预期内的结束方式
+        cur->m_cb = nullptr;
+        cur->m_state = TERM;
+        SYLAR_LOG_DEBUG(g_logger) << "Fiber cancelled: " << e.what()
+            << " fiber_id=" << cur->getId();
+    }
     catch(const std::exception& e) {
         cur->m_state = EXCEPT;
         SYLAR_LOG_ERROR(g_logger) << "Fiber Except: " << e.what()
@@ -239,6 +629,15 @@ void Fiber::MainFunc() {
             << std::endl
             << sylar::BacktraceToString();
     }
+    // 在协程自己的栈上销毁协程局部变量，析构函数中仍能访问本协程
+    cur->clearLocals();
+    if(cur->m_stackCheck) {
+        cur->recordStackUsage();
+    }
+    FiberTrace::Record(FiberTrace::TERM, cur->m_id);
+    if(cur->m_shared) {
+        LeaveSharedStack(cur.get());
+    }
     // 释放智能指针
     auto raw_ptr = cur.get();
     // 引用计数-1，主动释放Fiber::ptr。因为该Fiber::ptr局部变量存储在该协程的栈空间中，必须手动释放
@@ -262,6 +661,13 @@ void Fiber::CallerMainFunc() {
         cur->m_cb = nullptr;
         cur->m_state = TERM;
     }
+    catch(const CancelledError& e) {
+        // 被取消是预期内的结束方式
+        cur->m_cb = nullptr;
+        cur->m_state = TERM;
+        SYLAR_LOG_DEBUG(g_logger) << "Fiber cancelled: " << e.what()
+            << " fiber_id=" << cur->getId();
+    }
     catch(const std::exception& e) {
         cur->m_state = EXCEPT;
         SYLAR_LOG_ERROR(g_logger) << "Fiber Except: " << e.what()
@@ -276,6 +682,15 @@ void Fiber::CallerMainFunc() {
             << std::endl
             << sylar::BacktraceToString();
     }
+    // 在协程自己的栈上销毁协程局部变量，析构函数中仍能访问本协程
+    cur->clearLocals();
+    if(cur->m_stackCheck) {
+        cur->recordStackUsage();
+    }
+    FiberTrace::Record(FiberTrace::TERM, cur->m_id);
+    if(cur->m_shared) {
+        LeaveSharedStack(cur.get());
+    }
     // 释放智能指针
     auto raw_ptr = cur.get();
     // 引用计数-1，主动释放Fiber::ptr。因为该Fiber::ptr局部变量存储在该协程的栈空间中，必须手动释放
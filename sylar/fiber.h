@@ -10,10 +10,17 @@
 
 #include <memory>
 #include <functional>
-#include <ucontext.h>
+#include <vector>
+#include <string>
 #include "thread.h"
+#include "fiber_context.h"
+#include "unique_function.h"
+#include "cancellation.h"
 
 namespace sylar {
+
+class StackAllocator;
+
 /**
  * @brief 非对称协程
  * Thread ---> main_fiber <---> sub_fiber
@@ -28,6 +35,23 @@ namespace sylar {
 class Fiber : public std::enable_shared_from_this<Fiber> {
 public:
     typedef std::shared_ptr<Fiber> ptr;
+    // 协程的执行函数，只需可移动，小的可调用对象不分配堆内存
+    typedef UniqueFunction<void()> Callback;
+    /**
+     * @brief 栈使用统计，按协程入口（回调的类型）汇总，见 fiber.stack_check
+     */
+    struct StackStats {
+        // 入口，回调类型 demangle 后的名字
+        std::string entry;
+        // 结束的协程数
+        uint64_t count = 0;
+        // 栈大小（取最后一次）
+        size_t stack_size = 0;
+        // 栈使用的最大值
+        size_t max_used = 0;
+        // 栈使用的总和，除以 count 为平均值
+        size_t total_used = 0;
+    };
     enum State {
         INIT,
         READY,
@@ -35,6 +59,18 @@ public:
         TERM,
         EXCEPT
     };
+    /**
+     * @brief 线程亲和性：协程让出后再被调度时，调度器选择哪个线程恢复它
+     */
+    enum Affinity {
+        // 任意线程都可以恢复（默认）
+        AFFINITY_FREE,
+        // 优先回到上次运行的线程，缓存仍然是热的；在队列中等待超过
+        // scheduler.affinity.steal_us 后，其他线程才可以取走
+        AFFINITY_PREFER_LAST,
+        // 只在上次运行的线程恢复，第一次运行不限线程
+        AFFINITY_PINNED
+    };
 private:
     /**
      * @brief 线程的主协程构造
@@ -49,8 +85,10 @@ public:
      * @param cb 
      * @param stacksize 
      * @param isBackToCaller 该协程是否返回到Caller的主协程
+     * @param sharedStack 是否运行在线程的共享栈上，见 isSharedStack()
      */
-    Fiber(std::function<void()> cb, size_t stacksize = 0, bool isBackToCaller = false);
+    Fiber(Callback cb, size_t stacksize = 0, bool isBackToCaller = false
+            , bool sharedStack = false);
     ~Fiber();
     /**
      * @brief 可用于重置协程，在READY或TERM状态
@@ -58,7 +96,7 @@ public:
      * 
      * @param cb 执行函数
      */
-    void reset(std::function<void()> cb);
+    void reset(Callback cb);
     /**
      * @brief 切换成当前协程
      * 
@@ -82,6 +120,77 @@ public:
     uint64_t getId() const { return m_id; }
 
     State getState() const { return m_state; }
+    /**
+     * @brief 栈大小，共享栈协程和主协程为0
+     */
+    uint32_t getStackSize() const { return m_stacksize;}
+    /**
+     * @brief 是否为共享栈协程
+     * 共享栈协程没有自己的栈，运行在所在线程的共享栈（fiber.shared_stack_size）上，
+     * 切出后栈上实际用到的部分留在共享栈中，直到同线程的另一个共享栈协程要运行时，
+     * 才按实际大小拷贝到堆上，再次运行时拷回原位置。
+     * 大量挂起、栈很浅的协程（比如每连接一个协程）只占用与栈深度相当的内存，而不是每个一整块栈
+     *
+     * @attention 栈上变量的地址属于线程的共享栈，因此第一次运行后协程固定在该线程上恢复，
+     *            调度器会自动把它调度到该线程；共享栈协程不能作为 isBackToCaller 的调度协程。
+     *            ucontext 实现下不支持，退化为普通协程
+     */
+    bool isSharedStack() const { return m_shared;}
+    /**
+     * @brief 协程必须在哪个线程上恢复，-1 为不限
+     * 共享栈协程运行过之后，或 AFFINITY_PINNED 的协程运行过之后为上次运行的线程
+     */
+    pid_t getPinnedThread() const {
+        if(m_sharedThread != -1) {
+            return m_sharedThread;
+        }
+        return m_affinity == AFFINITY_PINNED ? m_lastThread : -1;
+    }
+    /**
+     * @brief 协程优先在哪个线程上恢复，只有 AFFINITY_PREFER_LAST 且运行过时不为-1
+     */
+    pid_t getPreferredThread() const {
+        return m_affinity == AFFINITY_PREFER_LAST ? m_lastThread : -1;
+    }
+
+    /**
+     * @brief 设置线程亲和性，下一次调度时生效。reset 时恢复为 AFFINITY_FREE
+     */
+    void setAffinity(Affinity affinity) { m_affinity = affinity;}
+    Affinity getAffinity() const { return m_affinity;}
+    /**
+     * @brief 上次运行所在的线程，由调度器在切入前记录，还没被调度器运行过为-1
+     */
+    pid_t getLastThread() const { return m_lastThread;}
+    void setLastThread(pid_t thread) { m_lastThread = thread;}
+
+    /**
+     * @brief 设置取消令牌，见 cancellation.h。reset 时清除
+     */
+    void setCancellationToken(CancellationToken::ptr token) { m_cancel = std::move(token);}
+    const CancellationToken::ptr& getCancellationToken() const { return m_cancel;}
+
+    // 协程局部变量内联存放的下标数量，超过的放在溢出数组中
+    static constexpr uint32_t LOCAL_INLINE_SLOTS = 8;
+    /**
+     * @brief 下标为 index 的协程局部变量，未设置返回nullptr，见 FiberLocal
+     */
+    void* getLocal(uint32_t index) const {
+        if(index < LOCAL_INLINE_SLOTS) {
+            return m_locals[index];
+        }
+        index -= LOCAL_INLINE_SLOTS;
+        return index < m_localSpill.size() ? m_localSpill[index] : nullptr;
+    }
+    /**
+     * @brief 设置下标为 index 的协程局部变量，不会销毁旧值
+     */
+    void setLocal(uint32_t index, void* val);
+    /**
+     * @brief 销毁本协程的所有协程局部变量
+     * 协程结束、reset 和析构时自动调用
+     */
+    void clearLocals();
 
 public:
     /**
@@ -91,6 +200,10 @@ public:
      * @attention 线程如果要创建协程，那么应该首先执行一下Fiber::GetThis()操作，以初始化主函数协程
      */
     static Fiber::ptr GetThis();
+    /**
+     * @brief 与 GetThis() 相同，但返回裸指针，不增减引用计数，用于 FiberLocal 这类热路径
+     */
+    static Fiber* GetThisPtr();
     /**
      * @brief Set the This object
      * 
@@ -104,11 +217,46 @@ public:
      * @return uint64_t 
      */
     static uint64_t GetFiberId();
+    /**
+     * @brief 当前协程的取消令牌，没有当前协程或没有设置时为空
+     */
+    static CancellationToken::ptr GetCancellationTokenOfThis();
+    /**
+     * @brief 当前协程是否已被取消（或已过截止时间）
+     */
+    static bool IsCancelled();
+    /**
+     * @brief 当前协程已被取消时抛出 CancelledError
+     */
+    static void CheckCancel();
     /**
      * @brief 让出cpu，转为READY态
-     * 
+     * 切回后如果协程已被取消，抛出 CancelledError
      */
     static void YieldToReady();
+    /**
+     * @brief 让出cpu，直接切换到 target，转为READY态
+     * 不经过调度协程：只有一次上下文切换，也不扫描任务队列。target 之后 yield 或结束时，
+     * 照常切回调度协程（没有调度器时为线程主协程），就像是它被调度协程切入的一样。
+     * 适合生产者/消费者、乒乓这类明确知道下一个要运行谁的场景
+     *
+     * @attention 1、只能在子协程中调用；target 不能正在运行，也不能同时在调度器的任务队列中，
+     *               否则可能被其他线程同时切入
+     *            2、与 YieldToReady 一样，当前协程需要由调用者负责重新调度或之后被 YieldTo 切回，
+     *               并且在此期间要有人持有它的引用
+     *            3、当前协程与 target 都是共享栈协程时，无法在共享栈上直接拷贝，
+     *               退化为 Scheduler::scheduleHandoff(target) + YieldToReady()
+     *            4、切回后如果当前协程已被取消，抛出 CancelledError
+     *            5、target 固定在其他线程（getPinnedThread）时同样退化为 scheduleHandoff + YieldToReady
+     */
+    static void YieldTo(Fiber::ptr target);
+    /**
+     * @brief 让出cpu，转为READY态；切回调度协程（或线程主协程）之后，由它执行 after(arg)
+     * 用于把当前协程放入等待队列：入队发生在当前协程的上下文保存之后，
+     * 唤醒者不可能切入一个还没有切出的协程。after 执行时当前协程的栈仍然有效，arg 可以指向栈上的对象
+     * @attention after 中不能切换协程，应尽快返回。不检查取消，由等待队列自行处理
+     */
+    static void YieldToPark(void (*after)(void* arg), void* arg);
 
     // 获取用于服务器统计分析的信息
     /**
@@ -117,6 +265,15 @@ public:
      * @return uint64_t 总协程数
      */
     static uint64_t TotalFibers();
+    /**
+     * @brief 获取各入口的栈使用统计
+     * 只有打开 fiber.stack_check 后创建的协程才参与统计
+     */
+    static std::vector<StackStats> GetStackStats();
+    /**
+     * @brief 清空栈使用统计
+     */
+    static void ResetStackStats();
     /**
      * @brief 协程要执行的函数
      * 
@@ -127,16 +284,63 @@ public:
      * 
      */
     static void CallerMainFunc();
+private:
+    /**
+     * @brief 共享栈协程切入前占用共享栈：保存上一个占用者的栈，恢复自己的栈
+     * 在切换前的上下文（调度协程）中执行，此时不在共享栈上
+     */
+    void takeSharedStack();
+    /**
+     * @brief 把共享栈上实际用到的部分保存到堆上
+     */
+    void saveSharedStack(char* top);
+    /**
+     * @brief 检查栈底的金丝雀，被改写说明栈已溢出
+     */
+    void checkStackCanary();
+    /**
+     * @brief 协程结束时扫描栈上的填充图案，记录实际用到的栈深度
+     */
+    void recordStackUsage();
 
 private:
     uint64_t m_id= 0;
     uint32_t m_stacksize = 0;
     State m_state = INIT;
 
-    ucontext_t m_ctx;
+    FiberContext m_ctx;
     void* m_stack = nullptr;
+    // 栈的分配器，主协程没有栈，为nullptr
+    StackAllocator* m_allocator = nullptr;
+
+    // 共享栈协程：第一次运行所在的线程，以及切出后保存到堆上的栈内容
+    bool m_shared = false;
+    pid_t m_sharedThread = -1;
+    char* m_savedStack = nullptr;
+    size_t m_savedSize = 0;
+    size_t m_savedCapacity = 0;
+
+    // 栈检查：创建时栈被填充，切出时检查金丝雀，结束时统计栈深度
+    bool m_stackCheck = false;
+    // 上一次运行用到的栈深度，reset 时只需重新填充这一段
+    size_t m_stackUsed = 0;
+    // 入口的类型名，统计的 key
+    const char* m_entry = nullptr;
+
+    // 协程局部变量，按 FiberLocal 的下标存放
+    void* m_locals[LOCAL_INLINE_SLOTS] = {};
+    std::vector<void*> m_localSpill;
+    // 是否设置过协程局部变量，没有时结束时不需要遍历
+    bool m_hasLocals = false;
+
+    // 取消令牌，见 cancellation.h
+    CancellationToken::ptr m_cancel;
+
+    // 线程亲和性，以及上次运行所在的线程
+    Affinity m_affinity = AFFINITY_FREE;
+    pid_t m_lastThread = -1;
 
-    std::function<void()> m_cb;
+    Callback m_cb;
 };
     
 }
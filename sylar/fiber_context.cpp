@@ -0,0 +1,176 @@
+/**
+ * @file fiber_context.cpp
+ * @brief 协程上下文切换实现
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ */
+#include "fiber_context.h"
+#include "log.h"
+#include "macor.h"
+#include <stdint.h>
+#include <string.h>
+
+#if SYLAR_FIBER_CONTEXT_ASM
+
+#if defined(__x86_64__)
+/**
+ * System V AMD64：callee-saved 为 rbx rbp r12-r15，另外保存 MXCSR 和 x87 控制字
+ * 栈上的布局（从低地址到高地址，sp 指向第一项）：
+ *   [mxcsr(4) fpucw(4) pad(8)] r15 r14 r13 r12 rbx rbp 返回地址
+ */
+asm(R"(
+    .text
+    .globl sylar_swap_context
+    .type sylar_swap_context, @function
+    .align 16
+sylar_swap_context:
+    .cfi_startproc
+    pushq %rbp
+    pushq %rbx
+    pushq %r12
+    pushq %r13
+    pushq %r14
+    pushq %r15
+    subq $16, %rsp
+    stmxcsr (%rsp)
+    fnstcw 4(%rsp)
+    movq %rsp, (%rdi)
+
+    movq %rsi, %rsp
+    ldmxcsr (%rsp)
+    fldcw 4(%rsp)
+    addq $16, %rsp
+    popq %r15
+    popq %r14
+    popq %r13
+    popq %r12
+    popq %rbx
+    popq %rbp
+    ret
+    .cfi_endproc
+    .size sylar_swap_context, .-sylar_swap_context
+
+    .globl sylar_context_entry
+    .type sylar_context_entry, @function
+    .align 16
+sylar_context_entry:
+    .cfi_startproc
+    .cfi_undefined rip
+    callq *%r12
+    ud2
+    .cfi_endproc
+    .size sylar_context_entry, .-sylar_context_entry
+)");
+
+// 保存区：浮点控制 16 + 6 个寄存器 + 返回地址
+static constexpr size_t CONTEXT_FRAME_SIZE = 16 + 6 * 8 + 8;
+// fn 所在的槽（r12），以 8 字节为单位，相对 sp
+static constexpr size_t CONTEXT_FN_SLOT = 2 + 3;
+static constexpr size_t CONTEXT_RET_SLOT = 2 + 6;
+
+#elif defined(__aarch64__)
+/**
+ * AAPCS64：callee-saved 为 x19-x28、x29(fp)、x30(lr) 以及 d8-d15
+ * 栈上的布局（从低地址到高地址，sp 指向第一项）：
+ *   x19 x20 ... x28 x29 x30 d8 ... d15
+ */
+asm(R"(
+    .text
+    .globl sylar_swap_context
+    .type sylar_swap_context, %function
+    .align 4
+sylar_swap_context:
+    .cfi_startproc
+    sub sp, sp, #160
+    stp x19, x20, [sp, #0]
+    stp x21, x22, [sp, #16]
+    stp x23, x24, [sp, #32]
+    stp x25, x26, [sp, #48]
+    stp x27, x28, [sp, #64]
+    stp x29, x30, [sp, #80]
+    stp d8, d9, [sp, #96]
+    stp d10, d11, [sp, #112]
+    stp d12, d13, [sp, #128]
+    stp d14, d15, [sp, #144]
+    mov x2, sp
+    str x2, [x0]
+
+    mov sp, x1
+    ldp x19, x20, [sp, #0]
+    ldp x21, x22, [sp, #16]
+    ldp x23, x24, [sp, #32]
+    ldp x25, x26, [sp, #48]
+    ldp x27, x28, [sp, #64]
+    ldp x29, x30, [sp, #80]
+    ldp d8, d9, [sp, #96]
+    ldp d10, d11, [sp, #112]
+    ldp d12, d13, [sp, #128]
+    ldp d14, d15, [sp, #144]
+    add sp, sp, #160
+    ret
+    .cfi_endproc
+    .size sylar_swap_context, .-sylar_swap_context
+
+    .globl sylar_context_entry
+    .type sylar_context_entry, %function
+    .align 4
+sylar_context_entry:
+    .cfi_startproc
+    .cfi_undefined x30
+    blr x19
+    brk #0
+    .cfi_endproc
+    .size sylar_context_entry, .-sylar_context_entry
+)");
+
+static constexpr size_t CONTEXT_FRAME_SIZE = 160;
+// fn 所在的槽（x19）与返回地址的槽（x30），以 8 字节为单位，相对 sp
+static constexpr size_t CONTEXT_FN_SLOT = 0;
+static constexpr size_t CONTEXT_RET_SLOT = 11;
+
+#endif
+
+extern "C" void sylar_context_entry();
+
+#endif
+
+namespace sylar {
+
+void MakeFiberContext(FiberContext* ctx, void* stack, size_t size, void (*fn)()) {
+#if SYLAR_FIBER_CONTEXT_ASM
+    // 栈顶按 16 字节对齐，保存区放在栈顶，恢复完后 sp 正好回到对齐的栈顶，
+    // 入口处 call / blr 时满足 ABI 的对齐要求
+    uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+    void** frame = (void**)(top - CONTEXT_FRAME_SIZE);
+    memset(frame, 0, CONTEXT_FRAME_SIZE);
+    frame[CONTEXT_FN_SLOT] = (void*)fn;
+    frame[CONTEXT_RET_SLOT] = (void*)&sylar_context_entry;
+#if defined(__x86_64__)
+    // 浮点控制字使用默认值：MXCSR 屏蔽全部异常、就近舍入；x87 64位精度
+    uint32_t* fpu = (uint32_t*)frame;
+    fpu[0] = 0x1F80;
+    fpu[1] = 0x037F;
+#endif
+    ctx->sp = frame;
+#else
+    if(getcontext(&ctx->uc)) {
+        SYLAR_ASSERT2(false, "getcontext");
+    }
+    // uc_link = nullptr，任何切换都必须显式进行
+    ctx->uc.uc_link = nullptr;
+    ctx->uc.uc_stack.ss_sp = stack;
+    ctx->uc.uc_stack.ss_size = size;
+    makecontext(&ctx->uc, fn, 0);
+#endif
+}
+
+const char* FiberContextImpl() {
+#if SYLAR_FIBER_CONTEXT_ASM
+    return "asm";
+#else
+    return "ucontext";
+#endif
+}
+
+}
@@ -0,0 +1,77 @@
+/**
+ * @file fiber_context.h
+ * @brief 协程上下文切换
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ */
+#ifndef __SYLAR_FIBER_CONTEXT_H__
+#define __SYLAR_FIBER_CONTEXT_H__
+
+#include <stddef.h>
+
+/**
+ * 默认在 x86-64 / aarch64 上使用汇编实现的切换，其他平台或定义了
+ * SYLAR_FIBER_USE_UCONTEXT（CMake 选项 SYLAR_FIBER_USE_ASM=OFF）时退回 ucontext。
+ * 这个宏决定了 FiberContext 的布局，必须对库和使用者一致，因此由 CMake 以 PUBLIC 传递
+ */
+#if !defined(SYLAR_FIBER_USE_UCONTEXT) && (defined(__x86_64__) || defined(__aarch64__))
+#   define SYLAR_FIBER_CONTEXT_ASM 1
+#else
+#   define SYLAR_FIBER_CONTEXT_ASM 0
+#   include <ucontext.h>
+#endif
+
+#if SYLAR_FIBER_CONTEXT_ASM
+extern "C" {
+/**
+ * @brief 保存当前的 callee-saved 寄存器到当前栈上，把栈顶写入 *from_sp，
+ * 然后切到 to_sp 指向的栈并恢复其寄存器
+ */
+void sylar_swap_context(void** from_sp, void* to_sp);
+}
+#endif
+
+namespace sylar {
+
+/**
+ * @brief 协程上下文
+ *
+ * 汇编实现：只保存 ABI 规定的 callee-saved 寄存器（以及浮点控制字），
+ * 上下文就是一个栈指针，寄存器都压在协程自己的栈上。
+ * 与 swapcontext 相比不保存信号屏蔽字，省掉每次切换一次 rt_sigprocmask 系统调用，
+ * 也不拷贝整个 ucontext_t。因此协程中修改的信号屏蔽字是整个线程共享的。
+ */
+struct FiberContext {
+#if SYLAR_FIBER_CONTEXT_ASM
+    void* sp = nullptr;
+#else
+    ucontext_t uc;
+#endif
+};
+
+/**
+ * @brief 在 [stack, stack + size) 上构造一个从 fn 开始执行的上下文
+ * fn 不能返回，结束时必须切换到其他上下文
+ */
+void MakeFiberContext(FiberContext* ctx, void* stack, size_t size, void (*fn)());
+
+/**
+ * @brief 保存当前上下文到 from，切换到 to
+ */
+inline void SwapFiberContext(FiberContext* from, FiberContext* to) {
+#if SYLAR_FIBER_CONTEXT_ASM
+    sylar_swap_context(&from->sp, to->sp);
+#else
+    swapcontext(&from->uc, &to->uc);
+#endif
+}
+
+/**
+ * @brief 当前使用的实现名，"asm" 或 "ucontext"
+ */
+const char* FiberContextImpl();
+
+}
+
+#endif
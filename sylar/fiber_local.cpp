@@ -0,0 +1,33 @@
+/**
+ * @file fiber_local.cpp
+ * @brief 协程局部变量实现
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ */
+#include "fiber_local.h"
+#include "log.h"
+#include <atomic>
+
+namespace sylar {
+
+// 定长数组 + 原子计数，协程结束时查析构函数不需要加锁
+static std::atomic<FiberLocalRegistry::Deleter> s_deleters[FiberLocalRegistry::MAX_KEYS];
+static std::atomic<uint32_t> s_key_count{0};
+
+uint32_t FiberLocalRegistry::Register(Deleter deleter) {
+    uint32_t index = s_key_count++;
+    SYLAR_ASSERT2(index < MAX_KEYS, "too many FiberLocal, max=" << MAX_KEYS);
+    s_deleters[index] = deleter;
+    return index;
+}
+
+FiberLocalRegistry::Deleter FiberLocalRegistry::GetDeleter(uint32_t index) {
+    return index < MAX_KEYS ? s_deleters[index].load() : nullptr;
+}
+
+uint32_t FiberLocalRegistry::Count() {
+    return s_key_count;
+}
+
+}
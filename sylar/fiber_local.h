@@ -0,0 +1,122 @@
+/**
+ * @file fiber_local.h
+ * @brief 协程局部变量
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ */
+#ifndef __SYLAR_FIBER_LOCAL_H__
+#define __SYLAR_FIBER_LOCAL_H__
+
+#include <stdint.h>
+#include <utility>
+#include "fiber.h"
+#include "macor.h"
+
+namespace sylar {
+
+/**
+ * @brief 协程局部变量的下标注册表
+ * 每个 FiberLocal 构造时分配一个下标，同时登记该类型的析构函数，
+ * 协程结束或 reset 时按下标调用析构函数。下标不回收，FiberLocal 应当像 thread_local 一样是静态对象
+ */
+class FiberLocalRegistry {
+public:
+    typedef void (*Deleter)(void*);
+    // 下标上限
+    static constexpr uint32_t MAX_KEYS = 1024;
+
+    /**
+     * @brief 分配下标
+     */
+    static uint32_t Register(Deleter deleter);
+    /**
+     * @brief 下标对应的析构函数，未注册返回nullptr
+     */
+    static Deleter GetDeleter(uint32_t index);
+    /**
+     * @brief 已注册的数量
+     */
+    static uint32_t Count();
+};
+
+/**
+ * @brief 协程局部变量，用法类似 thread_local，但作用域是当前协程
+ *
+ * 值按下标存放在协程对象内：前 Fiber::LOCAL_INLINE_SLOTS 个下标在协程内的定长数组中，
+ * 之后的放在溢出数组中。访问只是一次数组下标，不需要以协程id为key的全局表，也不加锁。
+ * 协程结束（包括异常结束）、reset 或析构时销毁该协程的所有值。
+ * 不在任何协程中时访问的是线程主协程的值。
+ *
+ * @example
+ * static sylar::FiberLocal<std::string> s_request_id;
+ * s_request_id.set("req-1");
+ * SYLAR_LOG_INFO(g_logger) << *s_request_id;
+ */
+template<class T>
+class FiberLocal {
+public:
+    FiberLocal()
+        :m_index(FiberLocalRegistry::Register(&FiberLocal::Delete)) {
+    }
+
+    FiberLocal(const FiberLocal&) = delete;
+    FiberLocal& operator=(const FiberLocal&) = delete;
+
+    /**
+     * @brief 当前协程的值，第一次访问时默认构造
+     */
+    T& get() {
+        Fiber* fiber = Fiber::GetThisPtr();
+        void* vp = fiber->getLocal(m_index);
+        if(SYLAR_UNLIKELY(!vp)) {
+            vp = new T();
+            fiber->setLocal(m_index, vp);
+        }
+        return *static_cast<T*>(vp);
+    }
+
+    /**
+     * @brief 当前协程的值，未设置返回nullptr
+     */
+    T* tryGet() const {
+        return static_cast<T*>(Fiber::GetThisPtr()->getLocal(m_index));
+    }
+
+    void set(T val) {
+        Fiber* fiber = Fiber::GetThisPtr();
+        void* vp = fiber->getLocal(m_index);
+        if(vp) {
+            *static_cast<T*>(vp) = std::move(val);
+        } else {
+            fiber->setLocal(m_index, new T(std::move(val)));
+        }
+    }
+
+    /**
+     * @brief 销毁当前协程的值
+     */
+    void reset() {
+        Fiber* fiber = Fiber::GetThisPtr();
+        void* vp = fiber->getLocal(m_index);
+        if(vp) {
+            fiber->setLocal(m_index, nullptr);
+            Delete(vp);
+        }
+    }
+
+    T& operator*() { return get();}
+    T* operator->() { return &get();}
+
+    uint32_t getIndex() const { return m_index;}
+private:
+    static void Delete(void* vp) {
+        delete static_cast<T*>(vp);
+    }
+private:
+    uint32_t m_index;
+};
+
+}
+
+#endif
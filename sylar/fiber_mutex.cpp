@@ -0,0 +1,246 @@
+/**
+ * @file fiber_mutex.cpp
+ * @brief 协程同步原语实现
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ */
+#include "fiber_mutex.h"
+#include "scheduler.h"
+#include <vector>
+#include <algorithm>
+
+namespace sylar {
+
+struct FiberWaitQueue::ParkArgs {
+    FiberWaitQueue* queue;
+    Spinlock* lock;
+    Waiter waiter;
+};
+
+struct FiberWaitQueue::ParkManyArgs {
+    const std::vector<FiberWaitQueue*>* queues;
+    const std::vector<Spinlock*>* locks;
+    Waiter waiter;
+};
+
+void FiberWaitQueue::ParkEnqueueMany(void* arg) {
+    ParkManyArgs* args = static_cast<ParkManyArgs*>(arg);
+    for(auto q : *args->queues) {
+        q->m_waiters.push_back(args->waiter);
+    }
+    for(auto l : *args->locks) {
+        l->unlock();
+    }
+}
+
+void FiberWaitQueue::ParkEnqueue(void* arg) {
+    ParkArgs* args = static_cast<ParkArgs*>(arg);
+    args->queue->m_waiters.push_back(std::move(args->waiter));
+    args->lock->unlock();
+}
+
+void FiberWaitQueue::wait(Spinlock& lock) {
+    Scheduler* sc = Scheduler::GetThis();
+    // 只有调度器中的子协程才能挂起：主协程（id为0）和调度协程挂起后没有人能切回来
+    if(sc && Fiber::GetFiberId() != 0 && Fiber::GetThisPtr() != Scheduler::GetMainFiber()) {
+        // 入队和释放 lock 都放到切出之后，由调度协程完成；等待期间队列持有协程的引用
+        ParkArgs args{this, &lock, Waiter{Fiber::GetThis(), sc, nullptr}};
+        Fiber::YieldToPark(&FiberWaitQueue::ParkEnqueue, &args);
+        return;
+    }
+    Semaphore sem(0);
+    m_waiters.push_back(Waiter{nullptr, nullptr, &sem});
+    lock.unlock();
+    sem.wait();
+}
+
+bool FiberWaitQueue::waitCancellable(Spinlock& lock) {
+    Scheduler* sc = Scheduler::GetThis();
+    Fiber* cur = Fiber::GetThisPtr();
+    if(!sc || Fiber::GetFiberId() == 0 || cur == Scheduler::GetMainFiber()
+            || !cur->getCancellationToken()) {
+        wait(lock);
+        return true;
+    }
+    const CancellationToken::ptr& cancel = cur->getCancellationToken();
+    if(cancel->isCancelled()) {
+        lock.unlock();
+        return false;
+    }
+    // 正常唤醒与取消谁先把 token 置位谁生效
+    Token token = std::make_shared<std::atomic<bool> >(false);
+    bool interrupted = false;
+    uint64_t id = cancel->addCallback([this, &lock, token, &interrupted]() {
+        if(token->exchange(true)) {
+            return;
+        }
+        // 协程可能还没入队：入队前一直持有 lock，这里拿到 lock 时一定已经在队列中
+        Waiter waiter;
+        {
+            Spinlock::Lock l(lock);
+            take(token, waiter);
+        }
+        // 在 Wake 之前写入，协程切回后才会读取
+        interrupted = true;
+        Wake(waiter);
+    });
+    if(id == 0) {
+        lock.unlock();
+        return false;
+    }
+    ParkArgs args{this, &lock, Waiter{Fiber::GetThis(), sc, nullptr, token}};
+    Fiber::YieldToPark(&FiberWaitQueue::ParkEnqueue, &args);
+    cancel->removeCallback(id);
+    return !interrupted;
+}
+
+void FiberWaitQueue::WaitMany(const std::vector<FiberWaitQueue*>& queues
+        , const std::vector<Spinlock*>& locks, const Token& token
+        , FiberWaitQueue** woken_by) {
+    Scheduler* sc = Scheduler::GetThis();
+    if(sc && Fiber::GetFiberId() != 0 && Fiber::GetThisPtr() != Scheduler::GetMainFiber()) {
+        ParkManyArgs args{&queues, &locks, Waiter{Fiber::GetThis(), sc, nullptr, token, woken_by}};
+        Fiber::YieldToPark(&FiberWaitQueue::ParkEnqueueMany, &args);
+        return;
+    }
+    // 作废的副本中的 sem 在本函数返回后悬空，但唤醒者会先检查 token，不会访问它
+    Semaphore sem(0);
+    for(auto q : queues) {
+        q->m_waiters.push_back(Waiter{nullptr, nullptr, &sem, token, woken_by});
+    }
+    for(auto l : locks) {
+        l->unlock();
+    }
+    sem.wait();
+}
+
+bool FiberWaitQueue::pop(Waiter& waiter) {
+    while(!m_waiters.empty()) {
+        waiter = std::move(m_waiters.front());
+        m_waiters.pop_front();
+        if(waiter.token && waiter.token->exchange(true)) {
+            // 已经在其他队列中被唤醒
+            continue;
+        }
+        // 只有赢得 token 的一方写入，等待者在 Wake 之后才读取
+        if(waiter.wokenBy) {
+            *waiter.wokenBy = this;
+        }
+        return true;
+    }
+    return false;
+}
+
+size_t FiberWaitQueue::remove(const Token& token) {
+    size_t size = m_waiters.size();
+    m_waiters.erase(std::remove_if(m_waiters.begin(), m_waiters.end()
+                , [&token](const Waiter& w) { return w.token == token;})
+            , m_waiters.end());
+    return size - m_waiters.size();
+}
+
+bool FiberWaitQueue::take(const Token& token, Waiter& waiter) {
+    for(auto it = m_waiters.begin(); it != m_waiters.end(); ++it) {
+        if(it->token == token) {
+            waiter = std::move(*it);
+            m_waiters.erase(it);
+            return true;
+        }
+    }
+    return false;
+}
+
+void FiberWaitQueue::Wake(Waiter& waiter) {
+    if(waiter.sem) {
+        waiter.sem->notify();
+        return;
+    }
+    // 同一调度线程上唤醒一个等待者：当前协程让出后直接运行它
+    waiter.scheduler->scheduleHandoff(std::move(waiter.fiber));
+}
+
+void FiberMutex::lockSlow() {
+    m_lock.lock();
+    // 标记有等待者；如果恰好已经解锁，就直接拿到锁
+    if(m_state.exchange(CONTENDED, std::memory_order_acquire) == UNLOCKED) {
+        m_lock.unlock();
+        return;
+    }
+    m_waiters.wait(m_lock);
+    // 被唤醒时锁已经由 unlock 直接交给了自己
+}
+
+void FiberMutex::unlockSlow() {
+    FiberWaitQueue::Waiter waiter;
+    {
+        Spinlock::Lock lock(m_lock);
+        if(!m_waiters.pop(waiter)) {
+            m_state.store(UNLOCKED, std::memory_order_release);
+            return;
+        }
+        // 不解锁，直接交给等待者，状态保持 CONTENDED，由它解锁时再检查队列
+    }
+    FiberWaitQueue::Wake(waiter);
+}
+
+void FiberCondition::wait(FiberMutex& mutex) {
+    // 先持有 m_lock 再释放 mutex：notify 必须等本执行流入队后才能取队列，不会丢失唤醒
+    m_lock.lock();
+    mutex.unlock();
+    bool woken = m_waiters.waitCancellable(m_lock);
+    mutex.lock();
+    if(!woken) {
+        throw CancelledError();
+    }
+}
+
+void FiberCondition::notifyOne() {
+    FiberWaitQueue::Waiter waiter;
+    {
+        Spinlock::Lock lock(m_lock);
+        if(!m_waiters.pop(waiter)) {
+            return;
+        }
+    }
+    FiberWaitQueue::Wake(waiter);
+}
+
+void FiberCondition::notifyAll() {
+    std::vector<FiberWaitQueue::Waiter> waiters;
+    {
+        Spinlock::Lock lock(m_lock);
+        FiberWaitQueue::Waiter waiter;
+        while(m_waiters.pop(waiter)) {
+            waiters.push_back(std::move(waiter));
+        }
+    }
+    for(auto& i : waiters) {
+        FiberWaitQueue::Wake(i);
+    }
+}
+
+void FiberSemaphore::waitSlow() {
+    m_lock.lock();
+    if(m_pending > 0) {
+        // notify 已经到达，但当时本执行流还没入队
+        --m_pending;
+        m_lock.unlock();
+        return;
+    }
+    m_waiters.wait(m_lock);
+}
+
+void FiberSemaphore::notifySlow() {
+    FiberWaitQueue::Waiter waiter;
+    {
+        Spinlock::Lock lock(m_lock);
+        if(!m_waiters.pop(waiter)) {
+            ++m_pending;
+            return;
+        }
+    }
+    FiberWaitQueue::Wake(waiter);
+}
+
+}
@@ -0,0 +1,240 @@
+/**
+ * @file fiber_mutex.h
+ * @brief 协程同步原语：互斥锁、条件变量、信号量
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * mutex.h 中的锁阻塞的是整个线程，协程在其上等待会让同一调度线程上的其他协程也无法运行。
+ * 这里的原语在等待时只挂起当前协程：把它放入等待队列后切回调度协程，被唤醒时通过
+ * Scheduler::schedule 重新调度（唤醒者与等待者在同一调度线程时走 scheduleHandoff 快速路径）。
+ * 无竞争时加锁/解锁只有一次CAS。
+ *
+ * 线程与协程混用：
+ * 1、在调度器的子协程中等待时，挂起的是协程；
+ * 2、不在调度器中（普通线程、线程主协程、调度协程本身）等待时，退化为用 Semaphore 阻塞线程；
+ * 3、唤醒者可以是任意线程或协程，同一把锁可以同时被协程和普通线程使用；
+ * 4、FiberMutex 解锁时直接把锁交给队首的等待者（FIFO），不会被后来者插队；
+ * 5、FiberCondition 的等待可以被协程的取消令牌打断（抛出 CancelledError，返回前已重新加锁）；
+ *    FiberMutex 持锁时间短，FiberSemaphore 的计数在等待者离开时无法安全回滚，二者的等待不可取消
+ * 6、协程在等待期间可能被调度到调度器的另一个线程上继续运行，因此不能在持有 FiberMutex 时依赖 thread_local，
+ *    也不能在一个线程加锁、期望同一线程解锁（可重入、线程归属都不做检查）。
+ */
+#ifndef __SYLAR_FIBER_MUTEX_H__
+#define __SYLAR_FIBER_MUTEX_H__
+
+#include <stdint.h>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <vector>
+#include "fiber.h"
+#include "mutex.h"
+#include "macor.h"
+
+namespace sylar {
+
+class Scheduler;
+
+/**
+ * @brief 协程/线程的等待队列，由使用者的 Spinlock 保护
+ */
+class FiberWaitQueue {
+public:
+    // 同一个等待者同时在多个队列中等待时共享的标记，第一个唤醒者置为true，其余队列中的副本作废
+    typedef std::shared_ptr<std::atomic<bool> > Token;
+
+    struct Waiter {
+        // 协程等待者及其调度器
+        Fiber::ptr fiber;
+        Scheduler* scheduler = nullptr;
+        // 线程等待者，指向等待线程栈上的信号量
+        Semaphore* sem = nullptr;
+        // 只在一个队列中等待时为空
+        Token token;
+        // 非空时，pop 出这个等待者的队列把自己写到这里（用于 select 得知是哪个队列唤醒的）
+        FiberWaitQueue** wokenBy = nullptr;
+    };
+
+    /**
+     * @brief 挂起当前执行流，直到被 Wake
+     * 调用时必须持有 lock，返回时 lock 已释放
+     */
+    void wait(Spinlock& lock);
+    /**
+     * @brief 可取消的等待：当前协程的取消令牌被取消时，从队列中移除自己并返回
+     * 不在调度器子协程中或协程没有取消令牌时与 wait 相同。调用时必须持有 lock，返回时 lock 已释放
+     * @return 被 Wake 唤醒返回true；被取消返回false，此时不会再被 Wake
+     */
+    bool waitCancellable(Spinlock& lock);
+    /**
+     * @brief 同时在多个队列上等待，任意一个队列唤醒即返回（用于 select）
+     * 调用时必须持有所有 locks，返回时已全部释放。
+     * 返回后其他队列中还留有作废的副本，调用者应加锁后用 remove(token) 清除
+     * @param[out] woken_by 非空时写入唤醒者所在的队列（由 pop 唤醒时）
+     */
+    static void WaitMany(const std::vector<FiberWaitQueue*>& queues
+            , const std::vector<Spinlock*>& locks, const Token& token
+            , FiberWaitQueue** woken_by = nullptr);
+    /**
+     * @brief 取出队首的等待者，调用时必须持有对应的 lock
+     * 跳过已被其他队列唤醒的作废副本，等待者设置了 wokenBy 时写入本队列
+     * @return 队列为空返回false
+     */
+    bool pop(Waiter& waiter);
+    /**
+     * @brief 删除标记为 token 的等待者，调用时必须持有对应的 lock
+     * @return 删除的数量
+     */
+    size_t remove(const Token& token);
+    /**
+     * @brief 取出标记为 token 的等待者，调用时必须持有对应的 lock
+     * @return 没有返回false
+     */
+    bool take(const Token& token, Waiter& waiter);
+    /**
+     * @brief 唤醒等待者，应在释放 lock 之后调用
+     */
+    static void Wake(Waiter& waiter);
+
+    bool empty() const { return m_waiters.empty();}
+    size_t size() const { return m_waiters.size();}
+private:
+    // 挂起的协程留给调度协程的入队参数，位于挂起协程的栈上
+    struct ParkArgs;
+    struct ParkManyArgs;
+    static void ParkEnqueue(void* arg);
+    static void ParkEnqueueMany(void* arg);
+private:
+    std::deque<Waiter> m_waiters;
+};
+
+/**
+ * @brief 协程互斥锁，不可重入
+ */
+class FiberMutex {
+public:
+    typedef ScopeLockImpl<FiberMutex> Lock;
+
+    FiberMutex() = default;
+    FiberMutex(const FiberMutex&) = delete;
+    FiberMutex& operator=(const FiberMutex&) = delete;
+
+    void lock() {
+        uint32_t expected = UNLOCKED;
+        if(SYLAR_LIKELY(m_state.compare_exchange_strong(expected, LOCKED
+                    , std::memory_order_acquire))) {
+            return;
+        }
+        lockSlow();
+    }
+
+    bool tryLock() {
+        uint32_t expected = UNLOCKED;
+        return m_state.compare_exchange_strong(expected, LOCKED, std::memory_order_acquire);
+    }
+
+    void unlock() {
+        uint32_t expected = LOCKED;
+        if(SYLAR_LIKELY(m_state.compare_exchange_strong(expected, UNLOCKED
+                    , std::memory_order_release))) {
+            return;
+        }
+        unlockSlow();
+    }
+private:
+    void lockSlow();
+    void unlockSlow();
+private:
+    enum {
+        UNLOCKED = 0,
+        // 已加锁，没有等待者
+        LOCKED = 1,
+        // 已加锁，可能有等待者，解锁时要检查等待队列
+        CONTENDED = 2
+    };
+    std::atomic<uint32_t> m_state{UNLOCKED};
+    Spinlock m_lock;
+    FiberWaitQueue m_waiters;
+};
+
+/**
+ * @brief 协程条件变量，配合 FiberMutex 使用
+ */
+class FiberCondition {
+public:
+    FiberCondition() = default;
+    FiberCondition(const FiberCondition&) = delete;
+    FiberCondition& operator=(const FiberCondition&) = delete;
+
+    /**
+     * @brief 释放 mutex 并等待通知，返回前重新加锁。调用时必须持有 mutex
+     * 与 std::condition_variable 一样可能被虚假唤醒，应在循环中检查条件。
+     * 协程被取消时重新加锁后抛出 CancelledError
+     */
+    void wait(FiberMutex& mutex);
+
+    template<class Predicate>
+    void wait(FiberMutex& mutex, Predicate pred) {
+        while(!pred()) {
+            wait(mutex);
+        }
+    }
+
+    void notifyOne();
+    void notifyAll();
+private:
+    Spinlock m_lock;
+    FiberWaitQueue m_waiters;
+};
+
+/**
+ * @brief 协程信号量
+ */
+class FiberSemaphore {
+public:
+    FiberSemaphore(uint32_t count = 0)
+        :m_count(count) {
+    }
+    FiberSemaphore(const FiberSemaphore&) = delete;
+    FiberSemaphore& operator=(const FiberSemaphore&) = delete;
+
+    void wait() {
+        // 计数为负时，其绝对值为等待者（含正在入队的）的数量
+        if(SYLAR_LIKELY(m_count.fetch_sub(1, std::memory_order_acquire) > 0)) {
+            return;
+        }
+        waitSlow();
+    }
+
+    bool tryWait() {
+        int64_t count = m_count.load(std::memory_order_relaxed);
+        while(count > 0) {
+            if(m_count.compare_exchange_weak(count, count - 1, std::memory_order_acquire)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void notify() {
+        if(SYLAR_LIKELY(m_count.fetch_add(1, std::memory_order_release) >= 0)) {
+            return;
+        }
+        notifySlow();
+    }
+
+    int64_t getCount() const { return m_count;}
+private:
+    void waitSlow();
+    void notifySlow();
+private:
+    std::atomic<int64_t> m_count;
+    Spinlock m_lock;
+    // 等待者已计入 m_count 但还没入队时到达的唤醒，由等待者入队前消费
+    uint32_t m_pending = 0;
+    FiberWaitQueue m_waiters;
+};
+
+}
+
+#endif
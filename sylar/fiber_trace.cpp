@@ -0,0 +1,314 @@
+/**
+ * @file fiber_trace.cpp
+ * @brief 协程切换追踪实现
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ */
+#include "fiber_trace.h"
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "config.h"
+#include "config_key.h"
+#include "mutex.h"
+#include "thread.h"
+#include "util.h"
+
+namespace sylar {
+
+std::atomic<bool> FiberTrace::s_enabled{false};
+
+static ConfigVar<bool>::ptr g_fiber_trace =
+    ConfigKey<"fiber.trace", bool>::Define(false, "record fiber switch events for chrome trace export (0/1)");
+static ConfigVar<uint32_t>::ptr g_fiber_trace_buffer_events =
+    ConfigKey<"fiber.trace.buffer_events", uint32_t>::Define(64 * 1024, "trace ring buffer size per thread, in 16 byte events");
+
+static uint64_t ReadTsc() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t v;
+    asm volatile("mrs %0, cntvct_el0" : "=r"(v));
+    return v;
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+static uint64_t NowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 打开追踪时的 TSC 与单调时钟，导出时用来换算 TSC 的频率
+static std::atomic<uint64_t> s_base_tsc{0};
+static std::atomic<uint64_t> s_base_ns{0};
+static std::atomic<uint32_t> s_buffer_events{64 * 1024};
+
+/**
+ * @brief 事件：TSC 时间戳，协程 id 左移8位后低8位放事件类型
+ */
+struct TraceEvent {
+    uint64_t tsc;
+    uint64_t data;
+};
+
+/**
+ * @brief 缓冲区中的一个事件槽，导出线程会与写入线程并发读，字段都是 relaxed 原子量
+ */
+struct TraceSlot {
+    std::atomic<uint64_t> tsc{0};
+    std::atomic<uint64_t> data{0};
+};
+
+/**
+ * @brief 线程的环形缓冲区，只有所属线程写
+ */
+struct TraceBuffer {
+    pid_t thread = -1;
+    // 由注册表的锁保护
+    std::string name;
+    std::unique_ptr<TraceSlot[]> events;
+    uint64_t mask = 0;
+    // 已写入的事件总数，下一个事件写在 head & mask
+    std::atomic<uint64_t> head{0};
+    // Clear 之后从这里开始读，由注册表的锁保护
+    uint64_t start = 0;
+};
+
+/**
+ * @brief 所有线程的缓冲区，线程退出后保留以便导出
+ * 故意泄漏，避免静态析构之后还有协程切换
+ */
+struct TraceRegistry {
+    Mutex mutex;
+    std::vector<TraceBuffer*> buffers;
+};
+
+static TraceRegistry& GetTraceRegistry() {
+    static TraceRegistry* s_registry = new TraceRegistry;
+    return *s_registry;
+}
+
+static thread_local TraceBuffer* t_trace_buffer = nullptr;
+
+static TraceBuffer* GetThreadBuffer() {
+    if(SYLAR_LIKELY(t_trace_buffer)) {
+        return t_trace_buffer;
+    }
+    uint64_t size = 2;
+    while(size < s_buffer_events) {
+        size <<= 1;
+    }
+    TraceBuffer* buf = new TraceBuffer;
+    buf->thread = GetThreadId();
+    buf->name = Thread::GetName();
+    buf->events.reset(new TraceSlot[size]);
+    buf->mask = size - 1;
+    TraceRegistry& reg = GetTraceRegistry();
+    Mutex::Lock lock(reg.mutex);
+    reg.buffers.push_back(buf);
+    t_trace_buffer = buf;
+    return buf;
+}
+
+struct FiberTraceIniter {
+    FiberTraceIniter() {
+        s_buffer_events = g_fiber_trace_buffer_events->getValue();
+        g_fiber_trace_buffer_events->addListener([](const uint32_t&, const uint32_t& new_value) {
+            // 只对之后创建的缓冲区生效
+            s_buffer_events = new_value;
+        });
+        FiberTrace::SetEnabled(g_fiber_trace->getValue());
+        g_fiber_trace->addListener([](const bool&, const bool& new_value) {
+            FiberTrace::SetEnabled(new_value);
+        });
+    }
+};
+
+static FiberTraceIniter __fiber_trace_init;
+
+void FiberTrace::SetEnabled(bool v) {
+    if(v && !IsEnabled()) {
+        s_base_ns = NowNs();
+        s_base_tsc = ReadTsc();
+    }
+    s_enabled.store(v, std::memory_order_relaxed);
+}
+
+void FiberTrace::RecordSlow(EventType type, uint64_t fiber_id) {
+    TraceBuffer* buf = GetThreadBuffer();
+    uint64_t head = buf->head.load(std::memory_order_relaxed);
+    TraceSlot& ev = buf->events[head & buf->mask];
+    // 与 Snapshot 中的 acquire 栅栏配对：读到这次写入的内容时，再读 head 至少是 head（顺序锁）
+    std::atomic_thread_fence(std::memory_order_release);
+    ev.tsc.store(ReadTsc(), std::memory_order_relaxed);
+    ev.data.store((fiber_id << 8) | (uint64_t)type, std::memory_order_relaxed);
+    buf->head.store(head + 1, std::memory_order_release);
+}
+
+void FiberTrace::SetThreadName(const std::string& name) {
+    if(!IsEnabled()) {
+        return;
+    }
+    TraceBuffer* buf = GetThreadBuffer();
+    TraceRegistry& reg = GetTraceRegistry();
+    Mutex::Lock lock(reg.mutex);
+    buf->name = name;
+}
+
+/**
+ * @brief 读出缓冲区中还有效的事件
+ * 复制之后再读一次 head（after）：第 i 个事件的槽会被第 i + size 次写入覆盖，
+ * 写入线程可能正在写第 after 个事件，所以 i + size <= after 的事件都可能读到了一半，丢弃
+ */
+static void Snapshot(TraceBuffer* buf, uint64_t start, std::vector<TraceEvent>& out) {
+    out.clear();
+    uint64_t size = buf->mask + 1;
+    uint64_t head = buf->head.load(std::memory_order_acquire);
+    uint64_t begin = std::max(start, head > size ? head - size : 0);
+    for(uint64_t i = begin; i < head; ++i) {
+        TraceSlot& ev = buf->events[i & buf->mask];
+        out.push_back(TraceEvent{ev.tsc.load(std::memory_order_relaxed)
+                , ev.data.load(std::memory_order_relaxed)});
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint64_t after = buf->head.load(std::memory_order_relaxed);
+    if(after + 1 > size + begin) {
+        uint64_t drop = std::min<uint64_t>(after + 1 - size - begin, out.size());
+        out.erase(out.begin(), out.begin() + drop);
+    }
+}
+
+static std::string EscapeJson(const std::string& str) {
+    std::string rt;
+    for(char c : str) {
+        if(c == '"' || c == '\\') {
+            rt.push_back('\\');
+            rt.push_back(c);
+        } else if((unsigned char)c < 0x20) {
+            rt.push_back(' ');
+        } else {
+            rt.push_back(c);
+        }
+    }
+    return rt;
+}
+
+size_t FiberTrace::ExportChromeJson(std::ostream& os) {
+    struct Source {
+        TraceBuffer* buf;
+        std::string name;
+        uint64_t start;
+    };
+    std::vector<Source> buffers;
+    {
+        TraceRegistry& reg = GetTraceRegistry();
+        Mutex::Lock lock(reg.mutex);
+        for(auto i : reg.buffers) {
+            buffers.push_back(Source{i, i->name, i->start});
+        }
+    }
+    // TSC 每微秒的计数，由打开追踪以来两种时钟的差值得出
+    uint64_t base_tsc = s_base_tsc;
+    uint64_t now_tsc = ReadTsc();
+    uint64_t elapsed_ns = NowNs() - s_base_ns;
+    double ticks_per_us = elapsed_ns ? (double)(now_tsc - base_tsc) * 1000.0 / elapsed_ns : 1.0;
+    if(ticks_per_us <= 0) {
+        ticks_per_us = 1.0;
+    }
+    auto to_us = [&](uint64_t tsc) {
+        return ((double)(int64_t)(tsc - base_tsc)) / ticks_per_us;
+    };
+
+    int pid = getpid();
+    size_t count = 0;
+    bool first = true;
+    auto sep = [&]() -> std::ostream& {
+        if(!first) {
+            os << ",\n";
+        }
+        first = false;
+        return os;
+    };
+    os.setf(std::ios::fixed);
+    os.precision(3);
+    os << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+
+    std::vector<TraceEvent> events;
+    for(auto& i : buffers) {
+        TraceBuffer* buf = i.buf;
+        sep() << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid
+            << ",\"tid\":" << buf->thread
+            << ",\"args\":{\"name\":\"" << EscapeJson(i.name) << "\"}}";
+
+        Snapshot(buf, i.start, events);
+        // 正在运行的协程：id -> 切入时间
+        std::unordered_map<uint64_t, uint64_t> running;
+        for(auto& e : events) {
+            uint64_t id = e.data >> 8;
+            EventType type = (EventType)(e.data & 0xff);
+            if(type == SWAP_IN) {
+                running[id] = e.tsc;
+                continue;
+            }
+            if(type == SWAP_OUT) {
+                auto it = running.find(id);
+                if(it == running.end()) {
+                    // 切入事件已被覆盖
+                    continue;
+                }
+                sep() << "{\"name\":\"fiber " << id << "\",\"cat\":\"fiber\",\"ph\":\"X\",\"ts\":"
+                    << to_us(it->second) << ",\"dur\":" << to_us(e.tsc) - to_us(it->second)
+                    << ",\"pid\":" << pid << ",\"tid\":" << buf->thread
+                    << ",\"args\":{\"fiber\":" << id << "}}";
+                running.erase(it);
+                ++count;
+                continue;
+            }
+            const char* name = type == CREATE ? "create" : (type == YIELD ? "yield" : "term");
+            sep() << "{\"name\":\"" << name << "\",\"cat\":\"fiber\",\"ph\":\"i\",\"s\":\"t\",\"ts\":"
+                << to_us(e.tsc) << ",\"pid\":" << pid << ",\"tid\":" << buf->thread
+                << ",\"args\":{\"fiber\":" << id << "}}";
+            ++count;
+        }
+        // 导出时还在运行的协程，区间截止到现在
+        for(auto& r : running) {
+            sep() << "{\"name\":\"fiber " << r.first << "\",\"cat\":\"fiber\",\"ph\":\"X\",\"ts\":"
+                << to_us(r.second) << ",\"dur\":" << to_us(now_tsc) - to_us(r.second)
+                << ",\"pid\":" << pid << ",\"tid\":" << buf->thread
+                << ",\"args\":{\"fiber\":" << r.first << ",\"running\":true}}";
+            ++count;
+        }
+    }
+    os << "\n]}\n";
+    return count;
+}
+
+bool FiberTrace::ExportChromeJson(const std::string& path) {
+    std::ofstream ofs(path);
+    if(!ofs) {
+        return false;
+    }
+    ExportChromeJson(ofs);
+    return (bool)ofs;
+}
+
+void FiberTrace::Clear() {
+    TraceRegistry& reg = GetTraceRegistry();
+    Mutex::Lock lock(reg.mutex);
+    for(auto i : reg.buffers) {
+        i->start = i->head.load(std::memory_order_acquire);
+    }
+}
+
+}
@@ -0,0 +1,94 @@
+/**
+ * @file fiber_trace.h
+ * @brief 协程切换追踪，导出为 Chrome trace JSON
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * 日志只能看到单个协程做了什么，看不到线程上协程之间的空档，也看不到长时间不让出、
+ * 饿死同线程其他协程的协程。打开 fiber.trace 后，协程的创建、切入、切出、让出、结束
+ * 都作为一个 16 字节的事件写入当前线程的环形缓冲区：
+ * 1、每个线程一个缓冲区，只有本线程写，不加锁；写满后覆盖最旧的事件（fiber.trace.buffer_events）
+ * 2、时间戳直接读 TSC（aarch64 为 cntvct_el0），导出时再按打开追踪以来的单调时钟换算成微秒，
+ *    要求 CPU 支持不变 TSC（constant_tsc），否则时间轴会漂移
+ * 3、ExportChromeJson 把所有线程的事件转换为 Chrome/Perfetto 可以直接打开的 JSON：
+ *    每段运行（切入到切出）是一个以协程 id 命名的区间，创建/让出/结束是瞬时事件，
+ *    线程以 Scheduler 的线程名显示
+ * 4、线程退出后缓冲区保留，导出时仍然可见；关闭追踪后写入立即停止，缓冲区中的内容不变
+ * 关闭时每个埋点只有一次 relaxed 的原子读
+ *
+ * @attention 导出时与写入并发不会出错，但正在被覆盖的事件会被丢弃；要完整的结果应先关闭追踪再导出
+ */
+#ifndef __SYLAR_FIBER_TRACE_H__
+#define __SYLAR_FIBER_TRACE_H__
+
+#include <stdint.h>
+#include <atomic>
+#include <ostream>
+#include <string>
+#include "macor.h"
+
+namespace sylar {
+
+class FiberTrace {
+public:
+    enum EventType {
+        // 创建协程，或从协程池中取出 reset
+        CREATE = 0,
+        // 切入协程开始运行
+        SWAP_IN,
+        // 协程切出
+        SWAP_OUT,
+        // 协程主动让出（YieldToReady / YieldTo），随后有一个 SWAP_OUT
+        YIELD,
+        // 协程入口函数返回，随后有一个 SWAP_OUT
+        TERM
+    };
+
+    /**
+     * @brief 是否打开了追踪，见 fiber.trace
+     */
+    static bool IsEnabled() { return s_enabled.load(std::memory_order_relaxed);}
+
+    /**
+     * @brief 记录协程 fiber_id 的一个事件到当前线程的缓冲区
+     */
+    static void Record(EventType type, uint64_t fiber_id) {
+        if(SYLAR_UNLIKELY(IsEnabled())) {
+            RecordSlow(type, fiber_id);
+        }
+    }
+
+    /**
+     * @brief 设置当前线程在导出结果中显示的名字，Scheduler::run 开始时调用
+     */
+    static void SetThreadName(const std::string& name);
+
+    /**
+     * @brief 把所有线程缓冲区中的事件写成 Chrome trace JSON
+     * @return 写出的事件数（不含线程名等元数据）
+     */
+    static size_t ExportChromeJson(std::ostream& os);
+    /**
+     * @brief 同上，写入文件 path
+     * @return 文件打不开返回false
+     */
+    static bool ExportChromeJson(const std::string& path);
+
+    /**
+     * @brief 丢弃所有缓冲区中已有的事件
+     */
+    static void Clear();
+private:
+    friend struct FiberTraceIniter;
+    static void RecordSlow(EventType type, uint64_t fiber_id);
+    /**
+     * @brief 打开时记录换算时间戳的基准，由 fiber.trace 的监听器调用
+     */
+    static void SetEnabled(bool v);
+private:
+    static std::atomic<bool> s_enabled;
+};
+
+}
+
+#endif
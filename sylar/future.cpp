@@ -0,0 +1,58 @@
+/**
+ * @file future.cpp
+ * @brief Future / Promise 实现
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ */
+#include "future.h"
+
+namespace sylar {
+
+void FutureStateBase::wait() {
+    if(isReady()) {
+        return;
+    }
+    m_lock.lock();
+    if(m_ready.load(std::memory_order_relaxed)) {
+        m_lock.unlock();
+        return;
+    }
+    if(!m_waiters.waitCancellable(m_lock)) {
+        throw CancelledError();
+    }
+}
+
+void FutureStateBase::addCallback(Callback cb) {
+    {
+        Spinlock::Lock lock(m_lock);
+        if(!m_ready.load(std::memory_order_relaxed)) {
+            m_callbacks.push_back(std::move(cb));
+            return;
+        }
+    }
+    cb();
+}
+
+void FutureStateBase::markReady() {
+    std::vector<FiberWaitQueue::Waiter> waiters;
+    std::vector<Callback> callbacks;
+    {
+        Spinlock::Lock lock(m_lock);
+        m_ready.store(true, std::memory_order_release);
+        FiberWaitQueue::Waiter waiter;
+        while(m_waiters.pop(waiter)) {
+            waiters.push_back(std::move(waiter));
+        }
+        callbacks.swap(m_callbacks);
+    }
+    for(auto& i : waiters) {
+        FiberWaitQueue::Wake(i);
+    }
+    // 回调中可能释放最后一个持有本状态的引用，之后不能再访问成员
+    for(auto& i : callbacks) {
+        i();
+    }
+}
+
+}
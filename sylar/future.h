@@ -0,0 +1,416 @@
+/**
+ * @file future.h
+ * @brief 调度任务的结果：Future / Promise
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * Scheduler::schedule 只管执行不管结果，过去要拿结果只能每次调用配一个 Semaphore 和 shared_ptr，
+ * 等待时还会阻塞整个线程。这里用一个共享状态保存结果：
+ * 1、get()/wait() 在调度器的子协程中挂起协程，其他执行流阻塞线程（同 fiber_mutex.h）
+ * 2、then 注册后续操作，结果就绪后在设置结果的执行流上直接执行（或交给指定调度器），返回新的 Future
+ * 3、WhenAll / WhenAny 组合多个 Future
+ * 4、任务抛出的异常保存在共享状态中，get() 时重新抛出；Promise 没设置结果就析构时为 broken_promise
+ * Future 可以复制，所有副本共享同一个结果，get() 返回结果的引用
+ */
+#ifndef __SYLAR_FUTURE_H__
+#define __SYLAR_FUTURE_H__
+
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <future>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "fiber_mutex.h"
+#include "scheduler.h"
+#include "unique_function.h"
+
+namespace sylar {
+
+/**
+ * @brief Future 共享状态中与结果类型无关的部分
+ */
+class FutureStateBase {
+public:
+    typedef UniqueFunction<void()> Callback;
+
+    FutureStateBase() = default;
+    FutureStateBase(const FutureStateBase&) = delete;
+    FutureStateBase& operator=(const FutureStateBase&) = delete;
+
+    bool isReady() const { return m_ready.load(std::memory_order_acquire);}
+
+    /**
+     * @brief 等待结果就绪，挂起中的协程被取消时抛出 CancelledError
+     */
+    void wait();
+
+    /**
+     * @brief 结果就绪后执行 cb：已就绪时立即在当前执行流执行，否则由设置结果的执行流执行
+     */
+    void addCallback(Callback cb);
+
+    /**
+     * @brief 就绪后才能访问
+     */
+    const std::exception_ptr& getException() const { return m_exception;}
+
+    /**
+     * @brief 抢占设置结果的权利，只有第一个调用者返回true
+     */
+    bool claim() { return !m_claimed.exchange(true, std::memory_order_acq_rel);}
+
+    /**
+     * @brief 写入异常并标记就绪，调用前必须 claim 成功
+     */
+    void setException(std::exception_ptr e) {
+        m_exception = std::move(e);
+        markReady();
+    }
+protected:
+    /**
+     * @brief 标记就绪：唤醒所有等待者，执行所有回调。结果必须已经写好
+     */
+    void markReady();
+private:
+    Spinlock m_lock;
+    FiberWaitQueue m_waiters;
+    std::vector<Callback> m_callbacks;
+    std::atomic<bool> m_ready{false};
+    std::atomic<bool> m_claimed{false};
+    std::exception_ptr m_exception;
+};
+
+template<class T>
+class FutureState : public FutureStateBase {
+public:
+    typedef std::shared_ptr<FutureState> ptr;
+
+    template<class... U>
+    void setValue(U&&... v) {
+        m_value.emplace(std::forward<U>(v)...);
+        markReady();
+    }
+
+    /**
+     * @brief 就绪且没有异常时才能访问
+     */
+    const T& value() const { return *m_value;}
+private:
+    std::optional<T> m_value;
+};
+
+template<>
+class FutureState<void> : public FutureStateBase {
+public:
+    typedef std::shared_ptr<FutureState> ptr;
+
+    void setValue() {
+        markReady();
+    }
+};
+
+template<class T>
+class Future;
+
+/**
+ * @brief 写入结果的一端，只可移动
+ */
+template<class T>
+class Promise {
+public:
+    Promise()
+        :m_state(std::make_shared<FutureState<T> >()) {
+    }
+    Promise(Promise&&) noexcept = default;
+    Promise& operator=(Promise&& other) noexcept {
+        if(this != &other) {
+            abandon();
+            m_state = std::move(other.m_state);
+        }
+        return *this;
+    }
+    Promise(const Promise&) = delete;
+    Promise& operator=(const Promise&) = delete;
+
+    ~Promise() {
+        abandon();
+    }
+
+    Future<T> getFuture() const { return Future<T>(m_state);}
+
+    /**
+     * @brief 设置结果
+     * @return 已经设置过结果返回false
+     */
+    template<class... U>
+    bool setValue(U&&... v) {
+        if(!m_state->claim()) {
+            return false;
+        }
+        m_state->setValue(std::forward<U>(v)...);
+        return true;
+    }
+
+    /**
+     * @brief 设置异常
+     * @return 已经设置过结果返回false
+     */
+    bool setException(std::exception_ptr e) {
+        if(!m_state->claim()) {
+            return false;
+        }
+        m_state->setException(std::move(e));
+        return true;
+    }
+
+    /**
+     * @brief 执行 fn，把返回值或抛出的异常作为结果
+     */
+    template<class F>
+    void setWith(F&& fn) {
+        try {
+            if constexpr(std::is_void_v<T>) {
+                std::forward<F>(fn)();
+                setValue();
+            } else {
+                setValue(std::forward<F>(fn)());
+            }
+        } catch(...) {
+            setException(std::current_exception());
+        }
+    }
+private:
+    void abandon() {
+        if(m_state && m_state->claim()) {
+            m_state->setException(std::make_exception_ptr(
+                        std::future_error(std::future_errc::broken_promise)));
+        }
+    }
+private:
+    typename FutureState<T>::ptr m_state;
+};
+
+/**
+ * @brief 读取结果的一端
+ */
+template<class T>
+class Future {
+public:
+    typedef T value_type;
+
+    Future() = default;
+    explicit Future(typename FutureState<T>::ptr state)
+        :m_state(std::move(state)) {
+    }
+
+    bool valid() const { return (bool)m_state;}
+    bool isReady() const { return m_state->isReady();}
+
+    void wait() const { m_state->wait();}
+
+    /**
+     * @brief 等待并返回结果，有异常时重新抛出
+     */
+    std::add_lvalue_reference_t<const T> get() const {
+        m_state->wait();
+        if(m_state->getException()) {
+            std::rethrow_exception(m_state->getException());
+        }
+        if constexpr(!std::is_void_v<T>) {
+            return m_state->value();
+        }
+    }
+
+    /**
+     * @brief 结果就绪后以结果调用 f（T 为 void 时无参数），在设置结果的执行流上执行
+     * 本 Future 的异常直接传给返回的 Future，不调用 f
+     * @return f 的返回值的 Future
+     */
+    template<class F>
+    auto then(F f) {
+        typedef typename ThenResult<F>::type R;
+        Promise<R> promise;
+        Future<R> rt = promise.getFuture();
+        m_state->addCallback([state = m_state, promise = std::move(promise), f = std::move(f)]() mutable {
+            Continue(state, promise, f);
+        });
+        return rt;
+    }
+
+    /**
+     * @brief 同 then(f)，但 f 作为任务交给调度器 sc 执行
+     */
+    template<class F>
+    auto then(Scheduler* sc, F f) {
+        typedef typename ThenResult<F>::type R;
+        Promise<R> promise;
+        Future<R> rt = promise.getFuture();
+        m_state->addCallback([sc, state = m_state, promise = std::move(promise), f = std::move(f)]() mutable {
+            sc->schedule([state, promise = std::move(promise), f = std::move(f)]() mutable {
+                Continue(state, promise, f);
+            });
+        });
+        return rt;
+    }
+
+    /**
+     * @brief 在 Task 中 co_await，结果就绪后在设置结果的执行流上恢复协程
+     * 需要回到某个调度器时再 co_await ResumeOn(sc)
+     */
+    struct Awaiter {
+        typename FutureState<T>::ptr state;
+
+        bool await_ready() const { return state->isReady();}
+        void await_suspend(std::coroutine_handle<> h) {
+            // 可能在 addCallback 内部就恢复了协程，之后不能再访问本对象
+            state->addCallback([h]() { h.resume();});
+        }
+        decltype(auto) await_resume() const { return Future(state).get();}
+    };
+    Awaiter operator co_await() const { return Awaiter{m_state};}
+
+    const typename FutureState<T>::ptr& getState() const { return m_state;}
+private:
+    template<class F>
+    struct ThenResult {
+        typedef std::invoke_result_t<F&, const T&> type;
+    };
+
+    template<class F>
+    requires std::is_void_v<T>
+    struct ThenResult<F> {
+        typedef std::invoke_result_t<F&> type;
+    };
+
+    template<class R, class F>
+    static void Continue(const typename FutureState<T>::ptr& state, Promise<R>& promise, F& f) {
+        if(state->getException()) {
+            promise.setException(state->getException());
+            return;
+        }
+        if constexpr(std::is_void_v<T>) {
+            promise.setWith(f);
+        } else {
+            promise.setWith([&]() { return f(state->value());});
+        }
+    }
+private:
+    typename FutureState<T>::ptr m_state;
+};
+
+template<class T>
+Future<T> MakeReadyFuture(T v) {
+    Promise<T> promise;
+    promise.setValue(std::move(v));
+    return promise.getFuture();
+}
+
+inline Future<void> MakeReadyFuture() {
+    Promise<void> promise;
+    promise.setValue();
+    return promise.getFuture();
+}
+
+/**
+ * @brief 所有 Future 都就绪后就绪
+ * 结果按输入顺序排列；任意一个有异常时，结果为第一个（按输入顺序）异常
+ */
+template<class T>
+auto WhenAll(std::vector<Future<T> > futures) {
+    typedef std::conditional_t<std::is_void_v<T>, void, std::vector<T> > R;
+    struct Context {
+        Promise<R> promise;
+        std::vector<Future<T> > futures;
+        std::atomic<size_t> remain;
+    };
+    auto ctx = std::make_shared<Context>();
+    Future<R> rt = ctx->promise.getFuture();
+    ctx->remain = futures.size();
+    ctx->futures = std::move(futures);
+    auto done = [ctx]() {
+        if(--ctx->remain != 0) {
+            return;
+        }
+        for(auto& i : ctx->futures) {
+            if(i.getState()->getException()) {
+                ctx->promise.setException(i.getState()->getException());
+                return;
+            }
+        }
+        if constexpr(std::is_void_v<T>) {
+            ctx->promise.setValue();
+        } else {
+            std::vector<T> values;
+            values.reserve(ctx->futures.size());
+            for(auto& i : ctx->futures) {
+                values.push_back(i.getState()->value());
+            }
+            ctx->promise.setValue(std::move(values));
+        }
+        // 回调持有 ctx，ctx 又持有各个 Future，完成后释放以断开引用环
+        ctx->futures.clear();
+    };
+    if(ctx->futures.empty()) {
+        ctx->remain = 1;
+        done();
+        return rt;
+    }
+    // 先复制一份：最后一个回调可能在 addCallback 中立刻执行并清空 ctx->futures
+    std::vector<Future<T> > futs = ctx->futures;
+    for(auto& i : futs) {
+        i.getState()->addCallback(done);
+    }
+    return rt;
+}
+
+/**
+ * @brief 任意一个 Future 就绪（包括异常）后就绪，结果为它的下标
+ * futures 为空时结果为 std::invalid_argument 异常
+ */
+template<class T>
+Future<size_t> WhenAny(std::vector<Future<T> > futures) {
+    auto promise = std::make_shared<Promise<size_t> >();
+    Future<size_t> rt = promise->getFuture();
+    if(futures.empty()) {
+        promise->setException(std::make_exception_ptr(std::invalid_argument("WhenAny of no futures")));
+        return rt;
+    }
+    for(size_t i = 0; i < futures.size(); ++i) {
+        // setValue 只有第一次生效
+        futures[i].getState()->addCallback([promise, i]() {
+            promise->setValue(i);
+        });
+    }
+    return rt;
+}
+
+template<class F>
+Future<std::invoke_result_t<std::decay_t<F>&> > Scheduler::scheduleWithResult(F&& fn, pid_t thread
+        , CancellationToken::ptr cancel) {
+    typedef std::invoke_result_t<std::decay_t<F>&> R;
+    Promise<R> promise;
+    Future<R> rt = promise.getFuture();
+    // 令牌不交给调度器：被调度器丢弃的任务只会得到 broken_promise，这里自己检查并给出 CancelledError
+    // 异常在这里捕获并写入结果，不会落到 Fiber::MainFunc 的 catch 中
+    schedule([promise = std::move(promise), fn = std::decay_t<F>(std::forward<F>(fn))
+            , cancel = std::move(cancel)]() mutable {
+        if(cancel) {
+            if(cancel->isCancelled()) {
+                promise.setException(std::make_exception_ptr(CancelledError()));
+                return;
+            }
+            Fiber::GetThis()->setCancellationToken(cancel);
+        }
+        promise.setWith(fn);
+    }, thread);
+    return rt;
+}
+
+}
+
+#endif
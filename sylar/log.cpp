@@ -721,10 +721,9 @@ struct LogDefine {
 };
 
 template<>
-class Lexical_cast<std::string, LogDefine> {
+class Lexical_cast<YAML::Node, LogDefine> {
 public:
-    LogDefine operator()(const std::string& v) {
-        YAML::Node n = YAML::Load(v);
+    LogDefine operator()(const YAML::Node& n) {
         LogDefine ld;
         if(!n["name"].IsDefined()) {
             std::cout << "log config error: name is null, " << n
@@ -787,6 +786,14 @@ public:
     }
 };
 
+template<>
+class Lexical_cast<std::string, LogDefine> {
+public:
+    LogDefine operator()(const std::string& v) {
+        return Lexical_cast<YAML::Node, LogDefine>()(YAML::Load(v));
+    }
+};
+
 template<>
 class Lexical_cast<LogDefine, std::string> {
 public:
@@ -64,7 +64,7 @@ public:
     }
 private:
     T& m_mutex;
-    bool m_locked;
+    bool m_locked = false;
 };
 
 // 对写锁进行加锁和解锁的RAII对象
@@ -95,7 +95,7 @@ public:
     }
 private:
     T& m_mutex;
-    bool m_locked;
+    bool m_locked = false;
 };
 
 // 对读锁进行加锁和解锁的RAII对象
@@ -126,7 +126,7 @@ public:
     }
 private:
     T& m_mutex;
-    bool m_locked;
+    bool m_locked = false;
 };
 
 // 互斥锁
@@ -8,6 +8,10 @@
 #include "scheduler.h"
 #include "log.h"
 #include "macor.h"
+#include "config.h"
+#include "config_key.h"
+#include "fiber_trace.h"
+#include <chrono>
 
 static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
 
@@ -16,6 +20,99 @@ namespace sylar {
 static thread_local Scheduler* t_scheduler = nullptr;
 // 执行Scheduler::run的协程，可称为调度协程
 static thread_local Fiber* t_scheduler_fiber = nullptr;
+// scheduleHandoff 放入的、调度协程下一个要运行的协程
+static thread_local Fiber::ptr t_handoff_fiber = nullptr;
+
+static ConfigVar<uint32_t>::ptr g_fiber_pool_max =
+    ConfigKey<"scheduler.fiber_pool.max", uint32_t>::Define(32, "max terminated fibers kept per scheduler thread");
+static ConfigVar<uint32_t>::ptr g_fiber_pool_idle_keep =
+    ConfigKey<"scheduler.fiber_pool.idle_keep", uint32_t>::Define(4, "fibers kept per scheduler thread when idle");
+
+static ConfigVar<uint32_t>::ptr g_affinity_steal_us =
+    ConfigKey<"scheduler.affinity.steal_us", uint32_t>::Define(200, "us a prefer-last fiber waits for its thread before others may take it");
+
+static std::atomic<uint32_t> s_fiber_pool_max{32};
+static std::atomic<uint32_t> s_fiber_pool_idle_keep{4};
+static std::atomic<uint32_t> s_affinity_steal_us{200};
+
+struct SchedulerIniter {
+    SchedulerIniter() {
+        s_fiber_pool_max = g_fiber_pool_max->getValue();
+        g_fiber_pool_max->addListener([](const uint32_t&, const uint32_t& new_value) {
+            s_fiber_pool_max = new_value;
+        });
+        s_fiber_pool_idle_keep = g_fiber_pool_idle_keep->getValue();
+        g_fiber_pool_idle_keep->addListener([](const uint32_t&, const uint32_t& new_value) {
+            s_fiber_pool_idle_keep = new_value;
+        });
+        s_affinity_steal_us = g_affinity_steal_us->getValue();
+        g_affinity_steal_us->addListener([](const uint32_t&, const uint32_t& new_value) {
+            s_affinity_steal_us = new_value;
+        });
+    }
+};
+
+static SchedulerIniter __scheduler_init;
+
+/**
+ * @brief 调度线程的空闲协程池，是 run() 的局部变量，不需要加锁
+ * 回调任务从池中取已结束的协程 reset 后运行；运行结束的协程（无论是直接结束的回调任务，
+ * 还是 yield 过、之后作为 fiber 任务被调度到结束的）只要没有其他引用，就放回池中，
+ * 池中协程数不超过 scheduler.fiber_pool.max，空闲时收缩到 scheduler.fiber_pool.idle_keep
+ */
+class FiberPool {
+public:
+    FiberPool(std::atomic<uint64_t>& created, std::atomic<uint64_t>& reused)
+        :m_created(created)
+        ,m_reused(reused) {
+    }
+
+    Fiber::ptr get(Fiber::Callback&& cb) {
+        if(!m_fibers.empty()) {
+            Fiber::ptr fiber = std::move(m_fibers.back());
+            m_fibers.pop_back();
+            fiber->reset(std::move(cb));
+            ++m_reused;
+            return fiber;
+        }
+        Fiber::ptr fiber = std::make_shared<Fiber>(std::move(cb));
+        // 只回收与自己创建的协程栈大小相同的协程，避免用户指定的小栈被拿去跑普通任务
+        m_stacksize = fiber->getStackSize();
+        ++m_created;
+        return fiber;
+    }
+
+    /**
+     * @brief 运行后释放协程的引用，可复用时放回池中
+     */
+    void recycle(Fiber::ptr& fiber) {
+        if(fiber && (fiber->getState() == Fiber::TERM || fiber->getState() == Fiber::EXCEPT)
+                && fiber.use_count() == 1
+                && !fiber->isSharedStack()
+                && fiber->getStackSize() == m_stacksize
+                && m_fibers.size() < s_fiber_pool_max) {
+            // 清除cb，释放回调捕获的资源，但是不析构对象，方便下次使用
+            fiber->reset(nullptr);
+            m_fibers.push_back(std::move(fiber));
+        }
+        fiber.reset();
+    }
+
+    /**
+     * @brief 空闲时收缩
+     */
+    void trim() {
+        size_t keep = s_fiber_pool_idle_keep;
+        if(m_fibers.size() > keep) {
+            m_fibers.resize(keep);
+        }
+    }
+private:
+    std::vector<Fiber::ptr> m_fibers;
+    uint32_t m_stacksize = 0;
+    std::atomic<uint64_t>& m_created;
+    std::atomic<uint64_t>& m_reused;
+};
 
 Scheduler::Scheduler(size_t threads, bool use_caller, const std::string& name) 
     :m_name(name) {
@@ -83,6 +180,7 @@ void Scheduler::start() {
         return;
     }
     m_stopping = false;
+    m_stopped = false;
     SYLAR_ASSERT(m_threads.empty());
 
     m_threads.resize(m_threadCount);
@@ -171,6 +269,50 @@ void Scheduler::stop() {
     }
 }
 
+void Scheduler::scheduleHandoff(Fiber::ptr fiber) {
+    if(GetThis() != this || t_handoff_fiber || !t_scheduler_fiber
+            || fiber->getState() == Fiber::EXEC
+            || (fiber->getPinnedThread() != -1 && fiber->getPinnedThread() != GetThreadId())) {
+        schedule(std::move(fiber));
+        return;
+    }
+    t_handoff_fiber = std::move(fiber);
+}
+
+uint64_t Scheduler::NowUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+Scheduler::ThreadCounters* Scheduler::getThreadCountersNoLock(pid_t thread) {
+    for(auto& i : m_threadCounters) {
+        if(i->thread == thread) {
+            return i.get();
+        }
+    }
+    m_threadCounters.push_back(std::make_unique<ThreadCounters>());
+    ThreadCounters* counters = m_threadCounters.back().get();
+    counters->thread = thread;
+    counters->name = Thread::GetName();
+    return counters;
+}
+
+std::vector<Scheduler::ThreadStats> Scheduler::getThreadStats() {
+    std::vector<ThreadStats> stats;
+    MutexType::Lock lock(m_mutex);
+    stats.reserve(m_threadCounters.size());
+    for(auto& i : m_threadCounters) {
+        ThreadStats s;
+        s.thread = i->thread;
+        s.name = i->name;
+        s.resumes = i->resumes.load(std::memory_order_relaxed);
+        s.migrations = i->migrations.load(std::memory_order_relaxed);
+        s.steals = i->steals.load(std::memory_order_relaxed);
+        stats.push_back(std::move(s));
+    }
+    return stats;
+}
+
 void Scheduler::setThis() {
     t_scheduler = this;
 }
@@ -178,6 +320,8 @@ void Scheduler::setThis() {
 void Scheduler::run() {
     SYLAR_LOG_DEBUG(g_logger) << m_name << " run";
     setThis();
+    // 追踪结果中以调度线程的名字显示本线程
+    FiberTrace::SetThreadName(Thread::GetName());
     if(GetThreadId() != m_rootThreadId) {
         /**
          * @brief 此时非use_caller线程，要对t_fiber进行初始化；use_call线程已经初始化了一个调度协程rootFiber执行run()。
@@ -189,36 +333,60 @@ void Scheduler::run() {
     }
     // idle协程创建
     Fiber::ptr idleFiber = std::make_shared<Fiber>(std::bind(&Scheduler::idle, this));
-    // 用于执行回调函数的协程
-    Fiber::ptr cbFiber;
+    // 本线程已结束、可复用的协程
+    FiberPool fiberPool(m_fibersCreated, m_fibersReused);
+    // 线程id每次获取都是系统调用，扫描任务队列时用缓存的
+    const pid_t tid = GetThreadId();
+    ThreadCounters* counters = nullptr;
+    {
+        MutexType::Lock lock(m_mutex);
+        counters = getThreadCountersNoLock(tid);
+    }
 
     Task task;
     while(true) {
         // 循环一开始进行重置
         task.reset();
         bool tickle_me = false;
-        {
+        if(t_handoff_fiber) {
+            // handoff 槽中的协程优先，不需要访问任务队列
+            task.fiber = std::move(t_handoff_fiber);
+            ++m_activeThreadCount;
+        } else {
             // 从任务的消息队列中选择一个任务
             MutexType::Lock lock(m_mutex);
+            // 遇到其他线程的 PREFER_LAST 协程时才取时间
+            uint64_t now = 0;
             auto it = m_tasks.begin();
             while (it != m_tasks.end())
             {
-                if(it->thread != -1 && it->thread != GetThreadId()) {
+                if(it->thread != -1 && it->thread != tid) {
                     // 这是指定了线程号的协程，且当前抢到执行权的线程不是目标，跳过
                     ++it;
                     // 标记一下需要通知其他线程进行调度
                     tickle_me = true;
                     continue;
                 }
+                if(it->prefer != -1 && it->prefer != tid) {
+                    if(now == 0) {
+                        now = NowUs();
+                    }
+                    if(now - it->readyUs < s_affinity_steal_us) {
+                        // 首选线程可能马上就来取，先留给它
+                        ++it;
+                        tickle_me = true;
+                        continue;
+                    }
+                }
 
-                SYLAR_ASSERT(it->fiber || it->cb);
+                SYLAR_ASSERT(it->fiber || it->cb || it->coro);
                 if(it->fiber && it->fiber->getState() == Fiber::EXEC) {
                     // 协程正在运行（有可能当协程要yield前会将其加入协程的消息队列）
                     ++it;
                     continue;
                 }
-                // 取出任务并将其移出任务队列
-                task = *it;
+                // 取出任务并将其移出任务队列，转移所有权而不是拷贝
+                task = std::move(*it);
                 // 在erase的同时就要++m_activeThreadCount，不能出现线程切换
                 // 防止中间m_tasks为空且m_activeThreadCount==0的空挡，导致线程的stopping()变为true引发idle协程退出
                 ++m_activeThreadCount;
@@ -235,6 +403,18 @@ void Scheduler::run() {
         
         if(task.fiber && (task.fiber->getState() != Fiber::TERM
                     && task.fiber->getState() != Fiber::EXCEPT)) {
+            if(task.fiber->getState() != Fiber::INIT) {
+                // 恢复让出过的协程，统计迁移
+                pid_t last = task.fiber->getLastThread();
+                counters->resumes.fetch_add(1, std::memory_order_relaxed);
+                if(last != -1 && last != tid) {
+                    counters->migrations.fetch_add(1, std::memory_order_relaxed);
+                    if(task.prefer != -1) {
+                        counters->steals.fetch_add(1, std::memory_order_relaxed);
+                    }
+                }
+            }
+            task.fiber->setLastThread(tid);
             // 执行协程
             task.fiber->swapIn();
             --m_activeThreadCount;
@@ -243,16 +423,28 @@ void Scheduler::run() {
             //     // 协程执行完后仍然为READY，说明发生了yield，需要重新加入任务队列
             //     schedule(std::move(task.fiber));
             // }
+            // yield 过的回调协程最终在这里结束，同样回收
+            fiberPool.recycle(task.fiber);
             task.reset();
         }
+        else if(task.coro) {
+            // 无栈协程的帧在堆上，直接在调度协程上恢复，运行到下一个挂起点返回
+            std::coroutine_handle<> coro = task.coro;
+            task.reset();
+            coro.resume();
+            --m_activeThreadCount;
+        }
         else if(task.cb) {
-            if(cbFiber) {
-                // 复用Fiber，减少重新分配栈空间的开销
-                cbFiber->reset(std::move(task.cb));
-            } else {
-                // 基于ft.cb创建一个协程
-                cbFiber = std::make_shared<Fiber>(task.cb);
+            if(task.cancel && task.cancel->isCancelled()) {
+                // 派生它的请求已经取消，不再执行
+                task.reset();
+                --m_activeThreadCount;
+                continue;
             }
+            // 优先复用池中的协程，减少重新分配栈空间的开销
+            Fiber::ptr cbFiber = fiberPool.get(std::move(task.cb));
+            cbFiber->setCancellationToken(std::move(task.cancel));
+            cbFiber->setLastThread(tid);
             task.reset();
 
             // 执行协程
@@ -260,19 +452,8 @@ void Scheduler::run() {
             --m_activeThreadCount;
             
             // 协程要自我进行管理，即调用yield()前，需要主动加入任务队列
-            // if(cbFiber->getState() == Fiber::READY) {
-            //     // 协程执行完后仍然为READY，说明发生了yield，需要重新加入任务队列
-            //     schedule(std::move(cbFiber));
-            //     // cbFiber置空
-            //     cbFiber.reset();
-            // } 
-            if(cbFiber->getState() == Fiber::EXCEPT || cbFiber->getState() == Fiber::TERM) {
-                // 如果协程运行结束了。清除cb，但是不析构对象，方便下次使用
-                cbFiber->reset(nullptr);
-            } else {
-                // 协程未结束，不能重新利用
-                cbFiber.reset();
-            }
+            // 协程结束了就放回池中；未结束（yield）时只释放这里的引用，由持有者重新调度
+            fiberPool.recycle(cbFiber);
         }
         else {
             // 进到这个分支情况一定是任务队列空了，调度idle协程即可
@@ -283,6 +464,7 @@ void Scheduler::run() {
                 break;
             }
 
+            fiberPool.trim();
             ++m_idleThreadCount;
             idleFiber->swapIn();
             --m_idleThreadCount;
@@ -298,8 +480,13 @@ void Scheduler::tickle() {
 
 bool Scheduler::stopping() {
     MutexType::Lock lock(m_mutex);
-    return m_autoStop && m_stopping
+    bool rt = m_autoStop && m_stopping
         && m_tasks.empty() && m_activeThreadCount == 0;
+    if(rt) {
+        // 之后投递的任务没有线程执行，拒绝而不是静默丢弃
+        m_stopped = true;
+    }
+    return rt;
 }
 
 void Scheduler::idle() {
@@ -11,6 +11,7 @@
 #include <memory>
 #include <list>
 #include <atomic>
+#include <coroutine>
 
 #include "mutex.h"
 #include "thread.h"
@@ -18,12 +19,28 @@
 
 namespace sylar {
 
+template<class T>
+class Future;
+
 // 有栈非对称协程
 // 协程调度器基类
 class Scheduler {
 public:
     typedef std::shared_ptr<Scheduler> ptr;
     typedef Mutex MutexType;
+    /**
+     * @brief 调度线程的统计，见 getThreadStats
+     */
+    struct ThreadStats {
+        pid_t thread = -1;
+        std::string name;
+        // 恢复让出过的协程的次数
+        uint64_t resumes = 0;
+        // 其中上次在其他线程运行的次数（迁移）
+        uint64_t migrations = 0;
+        // 其中从首选线程取走 AFFINITY_PREFER_LAST 协程的次数
+        uint64_t steals = 0;
+    };
     /**
      * @brief 创建一个协程调度器。
      * @attention 仅进行参数配置，需要start()
@@ -60,21 +77,59 @@ public:
      * 
      */
     void stop();
+    /**
+     * @brief 执行回调任务时新建的协程数
+     */
+    uint64_t getFibersCreated() const { return m_fibersCreated;}
+    /**
+     * @brief 执行回调任务时从协程池复用的协程数
+     */
+    uint64_t getFibersReused() const { return m_fibersReused;}
+    /**
+     * @brief 各调度线程的恢复/迁移统计，按线程加入调度的顺序
+     */
+    std::vector<ThreadStats> getThreadStats();
 
-    // 调度器执行任务的方法
+    /**
+     * @brief 唤醒恰好一个等待者时的快速路径
+     * 在本调度器的线程中调用时，fiber 放入本线程的 handoff 槽：当前协程让出后，
+     * 调度协程下一个就运行它，不加锁、不扫描任务队列，也不唤醒其他线程。
+     * 槽已被占用、不在本调度器线程中、或 fiber 固定在其他线程时，退化为 schedule(fiber)
+     */
+    void scheduleHandoff(Fiber::ptr fiber);
+
+    /**
+     * @brief 调度器执行任务的方法，任务可以是 Fiber::ptr、回调或 std::coroutine_handle<>
+     * @param[in] cancel 只对回调任务有效：执行前已取消的回调不再执行，执行时作为回调协程的取消令牌。
+     *      任务不会自动继承调度者的令牌，要随当前请求一起取消时传入 Fiber::GetCancellationTokenOfThis()
+     * @return 调度器已停止（所有线程都已退出调度）时不接受任务，返回false，fc 被丢弃
+     */
     template<class FiberOrCb>
-    void schedule(FiberOrCb fc, pid_t thread = -1) {
+    bool schedule(FiberOrCb fc, pid_t thread = -1, CancellationToken::ptr cancel = nullptr) {
         bool need_tickle = false;
         {
             MutexType::Lock lock(m_mutex);
-            need_tickle = scheduleNoLock(fc, thread);
+            if(m_stopped) {
+                return false;
+            }
+            need_tickle = scheduleNoLock(std::move(fc), thread, std::move(cancel));
         }
         
         if(need_tickle) {
             // 唤醒
             tickle();
         }
+        return true;
     }
+    /**
+     * @brief 调度一个有返回值的回调任务
+     * @param[in] cancel 执行前已取消时不调用 fn，结果为 CancelledError；执行时作为回调协程的取消令牌
+     * @return 结果的 Future，fn 抛出的异常在 get() 时重新抛出。定义在 future.h
+     */
+    template<class F>
+    Future<std::invoke_result_t<std::decay_t<F>&> > scheduleWithResult(F&& fn, pid_t thread = -1
+            , CancellationToken::ptr cancel = nullptr);
+
     // 调度器执行任务的方法的批量版本，只需锁一次即可放入所有任务，保证任务连续
     template<class InputIterator>
     void schedule(InputIterator begin, InputIterator end) {
@@ -84,7 +139,7 @@ public:
             while (begin != end)
             {   
                 // 会转移原容器中任务的所有权
-                need_tickle = scheduleNoLock(std::move(*begin)) || need_tickle;
+                need_tickle = scheduleNoLock(std::move(*begin), -1, nullptr) || need_tickle;
                 begin++;
             }
             
@@ -129,18 +184,32 @@ private:
      * @tparam FiberOrCb 协程fiber or callback
      * @param fc 协程fiber or callback
      * @param thread 线程id
+     * @param cancel 回调任务的取消令牌
      * @return true 唤醒线程
      * @return false 不进行唤醒操作
      */
     template<class FiberOrCb>
-    bool scheduleNoLock(FiberOrCb fc, pid_t thread) {
+    bool scheduleNoLock(FiberOrCb fc, pid_t thread, CancellationToken::ptr cancel) {
         // 若放入前，任务组为空，说明此时所有线程都是阻塞态，因为没有任务可运行
         bool need_tickle = m_tasks.empty();
-        // FiberAndThread中对fc进行完美转发，即可值拷贝也可转移所有权
-        Task ft(fc, thread);
-        // 如果fiber或cb存在，就加入任务组
-        if(ft.fiber || ft.cb) {
-            m_tasks.push_back(ft);
+        // fc 按值传入，这里转移所有权，回调只需可移动
+        Task ft(std::move(fc), thread);
+        // 共享栈协程、AFFINITY_PINNED 的协程运行过之后只能回到原线程恢复
+        if(ft.fiber && ft.thread == -1) {
+            ft.thread = ft.fiber->getPinnedThread();
+            if(ft.thread == -1) {
+                ft.prefer = ft.fiber->getPreferredThread();
+                if(ft.prefer != -1) {
+                    ft.readyUs = NowUs();
+                }
+            }
+        }
+        if(ft.cb) {
+            ft.cancel = std::move(cancel);
+        }
+        // 如果fiber、cb或coro存在，就加入任务组
+        if(ft.fiber || ft.cb || ft.coro) {
+            m_tasks.push_back(std::move(ft));
         }
         // 是否需要进行唤醒操作
         return need_tickle;
@@ -149,9 +218,16 @@ private:
     // 可执行的结构体
     struct Task {
         Fiber::ptr fiber;
-        std::function<void()> cb;
+        Fiber::Callback cb;
+        // C++20 无栈协程，直接在调度协程上恢复，见 task.h
+        std::coroutine_handle<> coro;
         // 线程ID，可实现协程指定在某一个线程执行
         pid_t thread;
+        // AFFINITY_PREFER_LAST 协程的首选线程，以及入队时间（微秒），超时后其他线程可以取走
+        pid_t prefer = -1;
+        uint64_t readyUs = 0;
+        // 回调任务的取消令牌（调度时显式传入），已取消的回调不再执行
+        CancellationToken::ptr cancel;
 
         // 用完美转发兼容值传递和转移所有权，相比使用“std::move”或“智能指针的指针”性能稍微好一点点
         template<typename Ptr>
@@ -159,22 +235,52 @@ private:
         Task(Ptr&& f, pid_t thr)
             :fiber(std::forward<Ptr>(f)), thread(thr) {}
         // std::invocable<F> : 类型 F 是否可以像函数一样被调用
+        // coroutine_handle 也可调用，要排除在回调之外，否则会为它新建一个有栈协程
         template<typename F>
         requires std::invocable<F> &&
-        (!std::same_as<std::decay_t<F>, Fiber::ptr>)
+        (!std::same_as<std::decay_t<F>, Fiber::ptr>) &&
+        (!std::convertible_to<std::decay_t<F>, std::coroutine_handle<> >)
         Task(F&& f, pid_t thr)
             :cb(std::forward<F>(f)), thread(thr) {}
+        Task(std::coroutine_handle<> h, pid_t thr)
+            :coro(h), thread(thr) {}
 
         // 默认构造函数，防止无法占位初始化
         Task() 
             :fiber(nullptr), thread(-1) {}
 
+        // 回调只可移动，任务也只可移动
+        Task(Task&&) = default;
+        Task& operator=(Task&&) = default;
+
         void reset() {
             fiber = nullptr;
             cb = nullptr;
+            coro = nullptr;
             thread = -1;
+            prefer = -1;
+            readyUs = 0;
+            cancel = nullptr;
         }
     };
+
+    // 调度线程的计数器，只由所属线程写，独占缓存行
+    struct alignas(64) ThreadCounters {
+        pid_t thread = -1;
+        std::string name;
+        std::atomic<uint64_t> resumes{0};
+        std::atomic<uint64_t> migrations{0};
+        std::atomic<uint64_t> steals{0};
+    };
+
+    /**
+     * @brief 单调时钟，微秒
+     */
+    static uint64_t NowUs();
+    /**
+     * @brief 本线程的计数器，不存在时创建。调用时必须持有 m_mutex
+     */
+    ThreadCounters* getThreadCountersNoLock(pid_t thread);
     
 private:
     MutexType  m_mutex;
@@ -182,6 +288,8 @@ private:
     std::vector<Thread::ptr> m_threads;
     // 协程的消息队列。计划执行的任务（协程fiber或回调函数cb）
     std::list<Task> m_tasks;
+    // 各调度线程的计数器，只增不删，线程重新进入 run() 时复用
+    std::vector<std::unique_ptr<ThreadCounters> > m_threadCounters;
     // 调度协程 
     Fiber::ptr m_rootFiber;
     std::string m_name;
@@ -194,10 +302,15 @@ protected:
     std::atomic<size_t> m_activeThreadCount{0};
     std::atomic<size_t> m_idleThreadCount{0};
     std::atomic<bool> m_stopping = true;
+    // stopping() 成立之后不会再有线程取任务，schedule 不再接受任务，start() 时清除。在 m_mutex 内访问
+    bool m_stopped = false;
     // 是否自动停止
     std::atomic<bool> m_autoStop = false;
     // 主线程ID，use_caller的ID 
     int m_rootThreadId = 0;
+    // 回调任务的协程统计：新建的与复用的
+    std::atomic<uint64_t> m_fibersCreated{0};
+    std::atomic<uint64_t> m_fibersReused{0};
 };
 
 }
@@ -0,0 +1,359 @@
+/**
+ * @file stack_allocator.cpp
+ * @brief 协程栈分配器实现
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ */
+#include "stack_allocator.h"
+#include "config.h"
+#include "config_key.h"
+#include "log.h"
+#include "macor.h"
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <new>
+#include <errno.h>
+#include <string.h>
+
+namespace sylar {
+
+static Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+static ConfigVar<std::string>::ptr g_stack_allocator =
+    ConfigKey<"fiber.stack_allocator", std::string>::Define("pool"
+            , "fiber stack allocator, pool, mmap or malloc");
+static ConfigVar<uint32_t>::ptr g_stack_pool_thread_cache =
+    ConfigKey<"fiber.stack_pool.thread_cache", uint32_t>::Define(8
+            , "max cached stacks per size class per thread");
+static ConfigVar<uint32_t>::ptr g_stack_pool_global_max =
+    ConfigKey<"fiber.stack_pool.global_max", uint32_t>::Define(64
+            , "max cached stacks per size class in global pool");
+static ConfigVar<uint32_t>::ptr g_stack_pool_prefault =
+    ConfigKey<"fiber.stack_pool.prefault", uint32_t>::Define(0
+            , "bytes prefaulted from the stack top on system alloc, 0 disable");
+static ConfigVar<uint32_t>::ptr g_stack_pool_keep_resident =
+    ConfigKey<"fiber.stack_pool.keep_resident", uint32_t>::Define(16 * 1024
+            , "bytes kept resident from the stack top when a mmap stack returns to pool");
+
+// 分配路径上不读 ConfigVar（要加读锁），配置变化时由回调同步到这里
+static std::atomic<StackAllocator*> s_default_allocator{nullptr};
+static std::atomic<uint32_t> s_thread_cache{8};
+static std::atomic<uint32_t> s_global_max{64};
+static std::atomic<uint32_t> s_prefault{0};
+static std::atomic<uint32_t> s_keep_resident{16 * 1024};
+
+static size_t GetPageSize() {
+    static const size_t s_page_size = sysconf(_SC_PAGESIZE);
+    return s_page_size;
+}
+
+struct StackAllocatorIniter {
+    StackAllocatorIniter() {
+        auto set_allocator = [](const std::string& name) {
+            StackAllocator* alloc = StackAllocator::GetByName(name);
+            if(!alloc) {
+                SYLAR_LOG_ERROR(g_logger) << "invalid fiber.stack_allocator=" << name
+                    << ", keep " << StackAllocator::GetDefault()->getName();
+                return;
+            }
+            s_default_allocator = alloc;
+        };
+        set_allocator(g_stack_allocator->getValue());
+        g_stack_allocator->addListener([set_allocator](const std::string&, const std::string& new_value) {
+            set_allocator(new_value);
+        });
+
+        s_thread_cache = g_stack_pool_thread_cache->getValue();
+        g_stack_pool_thread_cache->addListener([](const uint32_t&, const uint32_t& new_value) {
+            s_thread_cache = new_value;
+        });
+        s_global_max = g_stack_pool_global_max->getValue();
+        g_stack_pool_global_max->addListener([](const uint32_t&, const uint32_t& new_value) {
+            s_global_max = new_value;
+        });
+        s_prefault = g_stack_pool_prefault->getValue();
+        g_stack_pool_prefault->addListener([](const uint32_t&, const uint32_t& new_value) {
+            s_prefault = new_value;
+        });
+        s_keep_resident = g_stack_pool_keep_resident->getValue();
+        g_stack_pool_keep_resident->addListener([](const uint32_t&, const uint32_t& new_value) {
+            s_keep_resident = new_value;
+        });
+    }
+};
+
+static StackAllocatorIniter __stack_allocator_init;
+
+StackAllocator* StackAllocator::GetDefault() {
+    StackAllocator* alloc = s_default_allocator;
+    // 静态初始化完成之前（比如其他编译单元的全局协程）用池
+    return alloc ? alloc : PooledStackAllocator::GetInstance();
+}
+
+StackAllocator* StackAllocator::GetByName(const std::string& name) {
+    if(name == "pool") {
+        return PooledStackAllocator::GetInstance();
+    } else if(name == "mmap") {
+        return PooledStackAllocator::GetInstance(PooledStackAllocator::MMAP);
+    } else if(name == "malloc") {
+        return MallocStackAllocator::GetInstance();
+    }
+    return nullptr;
+}
+
+void* MallocStackAllocator::alloc(size_t size) {
+    void* vp = malloc(size);
+    if(!vp) {
+        throw std::bad_alloc();
+    }
+    return vp;
+}
+
+void MallocStackAllocator::dealloc(void* vp, size_t size) {
+    free(vp);
+}
+
+MallocStackAllocator* MallocStackAllocator::GetInstance() {
+    // 故意不析构：退出阶段仍可能有协程析构并归还栈
+    static MallocStackAllocator* s_instance = new MallocStackAllocator;
+    return s_instance;
+}
+
+// 0 未创建，1 可用，2 已析构
+// 用平凡类型记录线程缓存的状态：线程退出时其他 thread_local 对象（如持有协程的智能指针）
+// 可能在缓存析构之后才析构并归还栈，这时不能再访问缓存
+static thread_local int t_cache_state = 0;
+
+struct PooledStackAllocator::ThreadCache {
+    // 每种分配方式各自一组空闲链表
+    std::vector<void*> free[TYPE_COUNT][CLASS_COUNT];
+
+    ThreadCache() {
+        t_cache_state = 1;
+    }
+
+    ~ThreadCache() {
+        t_cache_state = 2;
+        // 线程退出，缓存的栈交给其他线程复用
+        for(int t = 0; t < TYPE_COUNT; ++t) {
+            PooledStackAllocator* pool = PooledStackAllocator::GetInstance((Type)t);
+            for(size_t i = 0; i < CLASS_COUNT; ++i) {
+                pool->pushGlobal(i, free[t][i], 0);
+            }
+        }
+    }
+};
+
+PooledStackAllocator::PooledStackAllocator(Type type)
+    :m_type(type) {
+}
+
+PooledStackAllocator* PooledStackAllocator::GetInstance(Type type) {
+    // 故意不析构，原因同 MallocStackAllocator
+    static PooledStackAllocator* s_instances[TYPE_COUNT] = {
+        new PooledStackAllocator(MALLOC),
+        new PooledStackAllocator(MMAP)
+    };
+    return s_instances[type];
+}
+
+PooledStackAllocator::ThreadCache& PooledStackAllocator::GetThreadCache() {
+    static thread_local ThreadCache t_cache;
+    return t_cache;
+}
+
+int PooledStackAllocator::SizeClass(size_t size) {
+    if(size > MAX_CLASS_SIZE) {
+        return -1;
+    }
+    int idx = 0;
+    while(ClassSize(idx) < size) {
+        ++idx;
+    }
+    return idx;
+}
+
+void* PooledStackAllocator::alloc(size_t size) {
+    int idx = SizeClass(size);
+    if(idx < 0) {
+        return systemAlloc(size, size);
+    }
+    if(SYLAR_UNLIKELY(t_cache_state == 2)) {
+        return systemAlloc(ClassSize(idx), size);
+    }
+    std::vector<void*>& free_list = GetThreadCache().free[m_type][idx];
+    if(SYLAR_LIKELY(!free_list.empty())) {
+        void* vp = free_list.back();
+        free_list.pop_back();
+        return vp;
+    }
+    // 批量取回半个缓存，后续几次分配直接命中线程缓存
+    size_t batch = std::max<size_t>(1, s_thread_cache / 2);
+    if(popGlobal(idx, free_list, batch) > 0) {
+        ++m_globalHits;
+        void* vp = free_list.back();
+        free_list.pop_back();
+        return vp;
+    }
+    return systemAlloc(ClassSize(idx), size);
+}
+
+void PooledStackAllocator::dealloc(void* vp, size_t size) {
+    int idx = SizeClass(size);
+    if(idx < 0) {
+        systemFree(vp, size);
+        return;
+    }
+    releaseUnused(vp, ClassSize(idx), size);
+    if(SYLAR_UNLIKELY(t_cache_state == 2)) {
+        std::vector<void*> stacks{vp};
+        pushGlobal(idx, stacks, 0);
+        return;
+    }
+    std::vector<void*>& free_list = GetThreadCache().free[m_type][idx];
+    free_list.push_back(vp);
+    size_t limit = s_thread_cache;
+    if(free_list.size() > limit) {
+        // 保留一半，避免在上限附近反复与全局池交换
+        pushGlobal(idx, free_list, limit / 2);
+    }
+}
+
+void PooledStackAllocator::trim() {
+    if(t_cache_state == 1) {
+        ThreadCache& cache = GetThreadCache();
+        for(size_t i = 0; i < CLASS_COUNT; ++i) {
+            pushGlobal(i, cache.free[m_type][i], 0);
+        }
+    }
+    std::vector<void*> stacks[CLASS_COUNT];
+    {
+        Mutex::Lock lock(m_mutex);
+        for(size_t i = 0; i < CLASS_COUNT; ++i) {
+            stacks[i].swap(m_global[i]);
+        }
+    }
+    for(size_t i = 0; i < CLASS_COUNT; ++i) {
+        for(auto vp : stacks[i]) {
+            systemFree(vp, ClassSize(i));
+        }
+    }
+}
+
+PooledStackAllocator::Stats PooledStackAllocator::getStats() const {
+    Stats stats;
+    stats.system_allocs = m_systemAllocs;
+    stats.system_frees = m_systemFrees;
+    stats.global_hits = m_globalHits;
+    return stats;
+}
+
+void* PooledStackAllocator::systemAlloc(size_t size, size_t stack_size) {
+    void* vp = nullptr;
+    if(m_type == MMAP) {
+        // [保护页][栈]，栈从高地址向低地址增长，溢出时先碰到保护页
+        // MAP_NORESERVE：只占虚拟地址空间，物理页在第一次访问时才分配
+        size_t page = GetPageSize();
+        size = (size + page - 1) / page * page;
+        char* base = (char*)mmap(nullptr, size + page, PROT_READ | PROT_WRITE
+                , MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if(base == MAP_FAILED) {
+            SYLAR_LOG_ERROR(g_logger) << "mmap fiber stack fail, size=" << size
+                << " errno=" << errno << " " << strerror(errno);
+            throw std::bad_alloc();
+        }
+        if(mprotect(base, page, PROT_NONE)) {
+            SYLAR_LOG_ERROR(g_logger) << "mprotect fiber stack guard fail, errno="
+                << errno << " " << strerror(errno);
+            munmap(base, size + page);
+            throw std::bad_alloc();
+        }
+        vp = base + page;
+    } else {
+        vp = malloc(size);
+        if(!vp) {
+            throw std::bad_alloc();
+        }
+    }
+    ++m_systemAllocs;
+    size_t prefault = std::min<size_t>(s_prefault, stack_size);
+    if(prefault) {
+        // 从协程实际的栈顶（vp + stack_size，而不是级的末尾）开始逐页写一次
+        size_t page = GetPageSize();
+        volatile char* top = (char*)vp + stack_size;
+        for(size_t off = page; off <= prefault; off += page) {
+            top[-(ssize_t)off] = 0;
+        }
+    }
+    return vp;
+}
+
+void PooledStackAllocator::systemFree(void* vp, size_t size) {
+    ++m_systemFrees;
+    if(m_type == MMAP) {
+        size_t page = GetPageSize();
+        size = (size + page - 1) / page * page;
+        if(munmap((char*)vp - page, size + page)) {
+            SYLAR_LOG_ERROR(g_logger) << "munmap fiber stack fail, errno="
+                << errno << " " << strerror(errno);
+        }
+        return;
+    }
+    free(vp);
+}
+
+void PooledStackAllocator::releaseUnused(void* vp, size_t size, size_t stack_size) {
+    if(m_type != MMAP) {
+        return;
+    }
+    // 内容丢弃，再次访问时得到全零的新页
+    auto release = [](char* begin, char* end) {
+        if(begin < end && madvise(begin, end - begin, MADV_DONTNEED)) {
+            SYLAR_LOG_ERROR(g_logger) << "madvise fiber stack fail, errno="
+                << errno << " " << strerror(errno);
+        }
+    };
+    // 栈顶（vp + stack_size）以下 keep_resident 字节的页下一个协程几乎一定会用到，
+    // 保留下来避免马上又缺页；窗口向外扩到整页，其余的页都还给内核
+    size_t page = GetPageSize();
+    char* base = (char*)vp;
+    size_t keep = std::min<size_t>(s_keep_resident, stack_size);
+    char* keep_begin = base + (stack_size - keep) / page * page;
+    char* keep_end = base + std::min((stack_size + page - 1) / page * page, size);
+    release(base, keep_begin);
+    // 栈顶之上（级的大小大于栈大小时）这个协程没有用到，一般本来就不驻留
+    release(keep_end, base + size);
+}
+
+size_t PooledStackAllocator::popGlobal(int idx, std::vector<void*>& out, size_t count) {
+    Mutex::Lock lock(m_mutex);
+    std::vector<void*>& global = m_global[idx];
+    size_t n = std::min(count, global.size());
+    out.insert(out.end(), global.end() - n, global.end());
+    global.resize(global.size() - n);
+    return n;
+}
+
+void PooledStackAllocator::pushGlobal(int idx, std::vector<void*>& stacks, size_t keep) {
+    if(stacks.size() <= keep) {
+        return;
+    }
+    size_t overflow_begin = stacks.size();
+    {
+        Mutex::Lock lock(m_mutex);
+        std::vector<void*>& global = m_global[idx];
+        size_t room = global.size() < s_global_max ? s_global_max - global.size() : 0;
+        size_t n = std::min(room, stacks.size() - keep);
+        global.insert(global.end(), stacks.begin() + keep, stacks.begin() + keep + n);
+        overflow_begin = keep + n;
+    }
+    // 全局池也满了，在锁外释放给系统
+    for(size_t i = overflow_begin; i < stacks.size(); ++i) {
+        systemFree(stacks[i], ClassSize(idx));
+    }
+    stacks.resize(keep);
+}
+
+}
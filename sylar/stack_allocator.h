@@ -0,0 +1,164 @@
+/**
+ * @file stack_allocator.h
+ * @brief 协程栈分配器
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ */
+#ifndef __SYLAR_STACK_ALLOCATOR_H__
+#define __SYLAR_STACK_ALLOCATOR_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <atomic>
+#include "mutex.h"
+
+namespace sylar {
+
+/**
+ * @brief 协程栈分配器接口
+ * Fiber 创建时记下所用的分配器，析构时还给同一个分配器，
+ * 因此运行中切换默认分配器不会把栈还错地方
+ *
+ * @attention 分配器必须比所有用它分配的协程活得久，内置的分配器都是不析构的单例
+ */
+class StackAllocator {
+public:
+    virtual ~StackAllocator() {}
+    /**
+     * @brief 分配 size 字节的栈
+     */
+    virtual void* alloc(size_t size) = 0;
+    /**
+     * @brief 归还栈，size 必须与 alloc 时相同
+     */
+    virtual void dealloc(void* vp, size_t size) = 0;
+    virtual const char* getName() const = 0;
+
+    /**
+     * @brief 当前默认分配器，由配置 fiber.stack_allocator 选择（"pool" / "mmap" / "malloc"）
+     */
+    static StackAllocator* GetDefault();
+    /**
+     * @brief 按名字获取内置分配器，不存在返回nullptr
+     */
+    static StackAllocator* GetByName(const std::string& name);
+};
+
+/**
+ * @brief 每次都直接 malloc / free
+ */
+class MallocStackAllocator : public StackAllocator {
+public:
+    void* alloc(size_t size) override;
+    void dealloc(void* vp, size_t size) override;
+    const char* getName() const override { return "malloc";}
+
+    static MallocStackAllocator* GetInstance();
+};
+
+/**
+ * @brief 池化的栈分配器
+ *
+ * 1、尺寸分级：按 2 的幂向上取整，最小 MIN_CLASS_SIZE，fiber.stack_size 的栈都落在同一级
+ * 2、线程缓存：每个线程每级一个空闲链表，分配和归还都只是 push / pop，不加锁
+ * 3、全局池：线程缓存满了把一半还给全局池；线程缓存空了从全局池批量取回；
+ *    线程退出时缓存全部还给全局池，给其他线程复用
+ * 4、预先缺页（fiber.stack_pool.prefault）：新向系统申请的栈逐页写一次，
+ *    把缺页从协程运行时挪到分配时，复用的栈本身已经缺过页
+ *
+ * 向系统申请的方式有两种：
+ * MALLOC：malloc / free
+ * MMAP：每个栈单独 mmap，最低地址处多映射一页 PROT_NONE 的保护页，
+ *    栈溢出时立即在保护页上触发 SIGSEGV，而不是悄悄写坏相邻的堆内存；
+ *    物理页在第一次访问时才分配，归还到池中时用 madvise(MADV_DONTNEED) 把栈顶
+ *    fiber.stack_pool.keep_resident 以下的页还给内核，驻留内存只与实际用到的栈深度有关
+ *
+ * 超过 MAX_CLASS_SIZE 的栈不入池，直接向系统申请和释放
+ */
+class PooledStackAllocator : public StackAllocator {
+public:
+    enum Type {
+        MALLOC = 0,
+        MMAP = 1,
+        TYPE_COUNT = 2
+    };
+
+    // 最小一级 16KB
+    static constexpr size_t MIN_CLASS_SIZE = 16 * 1024;
+    // 级数：16KB ... 16KB << (CLASS_COUNT - 1) = 64MB
+    static constexpr size_t CLASS_COUNT = 13;
+    static constexpr size_t MAX_CLASS_SIZE = MIN_CLASS_SIZE << (CLASS_COUNT - 1);
+
+    struct Stats {
+        // 向系统申请的次数
+        uint64_t system_allocs = 0;
+        // 释放给系统的次数
+        uint64_t system_frees = 0;
+        // 线程缓存为空、从全局池取回的次数
+        // 命中线程缓存是最常见的路径，为了不在线程间争抢计数器的缓存行，不做统计
+        uint64_t global_hits = 0;
+    };
+
+    void* alloc(size_t size) override;
+    void dealloc(void* vp, size_t size) override;
+    const char* getName() const override { return m_type == MMAP ? "mmap" : "pool";}
+    Type getType() const { return m_type;}
+
+    /**
+     * @brief 当前线程缓存全部还给全局池，全局池中的栈全部释放给系统
+     * 只影响调用线程的缓存，其他线程的缓存在它们退出时才归还
+     */
+    void trim();
+    Stats getStats() const;
+
+    static PooledStackAllocator* GetInstance(Type type = MALLOC);
+    /**
+     * @brief size 所在的级，不入池返回 -1
+     */
+    static int SizeClass(size_t size);
+    /**
+     * @brief 第 idx 级的实际分配大小
+     */
+    static size_t ClassSize(int idx) { return MIN_CLASS_SIZE << idx;}
+private:
+    struct ThreadCache;
+    friend struct ThreadCache;
+
+    PooledStackAllocator(Type type);
+    static ThreadCache& GetThreadCache();
+
+    /**
+     * @brief 向系统申请 size 字节
+     * @param[in] stack_size 协程实际使用的栈大小（<= size），栈顶在 vp + stack_size，预先缺页从这里往下
+     */
+    void* systemAlloc(size_t size, size_t stack_size);
+    void systemFree(void* vp, size_t size);
+    /**
+     * @brief 入池前把用不到的物理页还给内核，仅 MMAP
+     * @param[in] size 映射的大小（级的大小）
+     * @param[in] stack_size 协程实际使用的栈大小，保留的窗口从 vp + stack_size 往下算
+     */
+    void releaseUnused(void* vp, size_t size, size_t stack_size);
+    /**
+     * @brief 从全局池取最多 count 个追加到 out，返回取到的数量
+     */
+    size_t popGlobal(int idx, std::vector<void*>& out, size_t count);
+    /**
+     * @brief 把 stacks 中下标 keep 之后的栈放回全局池，超过上限的部分释放给系统
+     */
+    void pushGlobal(int idx, std::vector<void*>& stacks, size_t keep);
+private:
+    Type m_type;
+    Mutex m_mutex;
+    std::vector<void*> m_global[CLASS_COUNT];
+    std::atomic<uint64_t> m_systemAllocs{0};
+    std::atomic<uint64_t> m_systemFrees{0};
+    std::atomic<uint64_t> m_globalHits{0};
+};
+
+}
+
+#endif
@@ -10,12 +10,22 @@
 // 用于存放所有头文件，统一引用
 // 缺点：只要该头文件或其包含的任意头文件发生修改，所有包含它的 .cpp 都需要重新编译
 
+#include "cancellation.h"
+#include "channel.h"
 #include "config.h"
+#include "config_key.h"
+#include "config_watcher.h"
 #include "fiber.h"
+#include "fiber_local.h"
+#include "fiber_mutex.h"
+#include "fiber_trace.h"
+#include "future.h"
 #include "log.h"
 #include "macor.h"
 #include "singleton.h"
 #include "scheduler.h"
+#include "stack_allocator.h"
+#include "task.h"
 #include "thread.h"
 #include "util.h"
 
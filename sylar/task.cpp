@@ -0,0 +1,34 @@
+/**
+ * @file task.cpp
+ * @brief C++20 无栈协程任务实现
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ */
+#include "task.h"
+#include "log.h"
+
+namespace sylar {
+
+static Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+std::coroutine_handle<> TaskPromiseBase::OnFinal(TaskPromiseBase& promise, std::coroutine_handle<> h) noexcept {
+    if(promise.m_continuation) {
+        return promise.m_continuation;
+    }
+    if(promise.m_detached) {
+        if(promise.m_exception) {
+            try {
+                std::rethrow_exception(promise.m_exception);
+            } catch(const std::exception& e) {
+                SYLAR_LOG_ERROR(g_logger) << "Task Except: " << e.what();
+            } catch(...) {
+                SYLAR_LOG_ERROR(g_logger) << "Task Except";
+            }
+        }
+        h.destroy();
+    }
+    return std::noop_coroutine();
+}
+
+}
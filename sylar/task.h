@@ -0,0 +1,262 @@
+/**
+ * @file task.h
+ * @brief C++20 无栈协程任务，运行在 Scheduler 上
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * Fiber 是有栈协程，每个都要一块独立的栈；Task 是编译器生成的无栈协程，
+ * 只在堆上分配保存局部变量的协程帧（通常几百字节），适合大量并发的轻量操作。
+ *
+ * 1、Task 是惰性的：创建后不运行，被 co_await 或交给调度器（Spawn）时才开始
+ * 2、co_await 另一个 Task 时通过对称转移直接切过去，结束后切回，不经过调度器
+ * 3、co_await ResumeOn(sc) 把当前协程作为任务放入 sc 的任务队列，由调度线程恢复，
+ *    与 Fiber、回调任务共用同一个 m_tasks
+ * 4、调度器在调度协程上直接 resume，没有自己的栈，因此 Task 中不能调用会挂起 Fiber 的接口
+ *    （FiberMutex、Channel 等在这里会退化为阻塞线程），应改用 co_await
+ * 5、异常保存在协程帧中，在 co_await 处重新抛出；Spawn 出去没人等待的 Task 的异常只打日志
+ */
+#ifndef __SYLAR_TASK_H__
+#define __SYLAR_TASK_H__
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include "fiber_mutex.h"
+#include "scheduler.h"
+
+namespace sylar {
+
+template<class T = void>
+class Task;
+
+/**
+ * @brief Task 的 promise 中与返回值类型无关的部分
+ */
+class TaskPromiseBase {
+public:
+    struct FinalAwaiter {
+        bool await_ready() const noexcept { return false;}
+        template<class Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> h) noexcept {
+            return OnFinal(h.promise(), h);
+        }
+        void await_resume() noexcept {}
+    };
+
+    std::suspend_always initial_suspend() noexcept { return {};}
+    FinalAwaiter final_suspend() noexcept { return {};}
+    void unhandled_exception() noexcept { m_exception = std::current_exception();}
+
+    void setContinuation(std::coroutine_handle<> h) { m_continuation = h;}
+    void setDetached() { m_detached = true;}
+protected:
+    void rethrowIfError() {
+        if(m_exception) {
+            std::rethrow_exception(m_exception);
+        }
+    }
+private:
+    /**
+     * @brief 协程结束：有等待者时切回等待者，否则（Spawn 出去的）销毁协程帧
+     */
+    static std::coroutine_handle<> OnFinal(TaskPromiseBase& promise, std::coroutine_handle<> h) noexcept;
+protected:
+    // co_await 本协程的上层协程
+    std::coroutine_handle<> m_continuation;
+    std::exception_ptr m_exception;
+    // 不被任何 Task 对象持有，结束时自行销毁
+    bool m_detached = false;
+};
+
+template<class T>
+class TaskPromise : public TaskPromiseBase {
+public:
+    Task<T> get_return_object() noexcept;
+
+    template<class U>
+    requires std::convertible_to<U&&, T>
+    void return_value(U&& v) {
+        m_value.emplace(std::forward<U>(v));
+    }
+
+    T result() {
+        rethrowIfError();
+        return std::move(*m_value);
+    }
+private:
+    std::optional<T> m_value;
+};
+
+template<>
+class TaskPromise<void> : public TaskPromiseBase {
+public:
+    Task<void> get_return_object() noexcept;
+
+    void return_void() noexcept {}
+
+    void result() {
+        rethrowIfError();
+    }
+};
+
+/**
+ * @brief 无栈协程任务
+ * 只可移动；析构时销毁还没 Spawn 的协程帧
+ */
+template<class T>
+class [[nodiscard]] Task {
+public:
+    typedef TaskPromise<T> promise_type;
+    typedef std::coroutine_handle<promise_type> handle_type;
+
+    Task() noexcept = default;
+    explicit Task(handle_type h) noexcept
+        :m_handle(h) {
+    }
+    Task(Task&& other) noexcept
+        :m_handle(std::exchange(other.m_handle, nullptr)) {
+    }
+    Task& operator=(Task&& other) noexcept {
+        if(this != &other) {
+            if(m_handle) {
+                m_handle.destroy();
+            }
+            m_handle = std::exchange(other.m_handle, nullptr);
+        }
+        return *this;
+    }
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task() {
+        if(m_handle) {
+            m_handle.destroy();
+        }
+    }
+
+    bool valid() const { return (bool)m_handle;}
+    bool done() const { return m_handle && m_handle.done();}
+
+    /**
+     * @brief 放弃所有权，协程结束时自行销毁帧
+     * @return 可以交给 Scheduler::schedule 的句柄
+     */
+    std::coroutine_handle<> detach() {
+        m_handle.promise().setDetached();
+        return std::exchange(m_handle, nullptr);
+    }
+
+    struct Awaiter {
+        handle_type handle;
+
+        bool await_ready() const noexcept { return !handle || handle.done();}
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> h) noexcept {
+            handle.promise().setContinuation(h);
+            // 对称转移：直接开始运行被等待的协程
+            return handle;
+        }
+        T await_resume() {
+            return handle.promise().result();
+        }
+    };
+
+    Awaiter operator co_await() const & noexcept { return Awaiter{m_handle};}
+    Awaiter operator co_await() const && noexcept { return Awaiter{m_handle};}
+private:
+    handle_type m_handle;
+};
+
+template<class T>
+inline Task<T> TaskPromise<T>::get_return_object() noexcept {
+    return Task<T>(std::coroutine_handle<TaskPromise<T> >::from_promise(*this));
+}
+
+inline Task<void> TaskPromise<void>::get_return_object() noexcept {
+    return Task<void>(std::coroutine_handle<TaskPromise<void> >::from_promise(*this));
+}
+
+/**
+ * @brief 挂起当前协程，由调度器 sc 的线程（指定 thread 时为该线程）恢复
+ * 用法：co_await ResumeOn(sc);
+ * 调度器已停止、不接受任务时不挂起，在当前执行流上继续
+ */
+class ResumeOn {
+public:
+    explicit ResumeOn(Scheduler* sc, pid_t thread = -1)
+        :m_scheduler(sc)
+        ,m_thread(thread) {
+    }
+
+    bool await_ready() const noexcept { return false;}
+    bool await_suspend(std::coroutine_handle<> h) {
+        // 入队后可能立刻被其他线程恢复并销毁本对象，之后不能再访问成员
+        return m_scheduler->schedule(h, m_thread);
+    }
+    void await_resume() noexcept {}
+private:
+    Scheduler* m_scheduler;
+    pid_t m_thread;
+};
+
+/**
+ * @brief 把 Task 交给调度器运行，不等待结果
+ * @return 调度器已停止时返回false，task 没有运行，协程帧（及其持有的 Task）被销毁
+ */
+template<class T>
+bool Spawn(Scheduler* sc, Task<T> task, pid_t thread = -1) {
+    std::coroutine_handle<> h = task.detach();
+    if(!sc->schedule(h, thread)) {
+        // 还停在 initial_suspend，可以直接销毁
+        h.destroy();
+        return false;
+    }
+    return true;
+}
+
+template<class T>
+Task<void> SyncWaitBody(Task<T> task, std::optional<T>* value
+        , std::exception_ptr* error, FiberSemaphore* sem) {
+    try {
+        value->emplace(co_await task);
+    } catch(...) {
+        *error = std::current_exception();
+    }
+    sem->notify();
+}
+
+inline Task<void> SyncWaitBody(Task<void> task, std::optional<bool>* value
+        , std::exception_ptr* error, FiberSemaphore* sem) {
+    try {
+        co_await task;
+        value->emplace(true);
+    } catch(...) {
+        *error = std::current_exception();
+    }
+    sem->notify();
+}
+
+/**
+ * @brief 在调度器上运行 task 并等待结果，异常原样抛出
+ * 在调度器的子协程中调用时挂起 Fiber，其他情况阻塞线程；不能在 Task 中调用
+ */
+template<class T>
+T SyncWait(Scheduler* sc, Task<T> task) {
+    typedef std::conditional_t<std::is_void_v<T>, bool, T> Value;
+    std::optional<Value> value;
+    std::exception_ptr error;
+    FiberSemaphore sem(0);
+    Spawn(sc, SyncWaitBody(std::move(task), &value, &error, &sem));
+    sem.wait();
+    if(error) {
+        std::rethrow_exception(error);
+    }
+    if constexpr(!std::is_void_v<T>) {
+        return std::move(*value);
+    }
+}
+
+}
+
+#endif
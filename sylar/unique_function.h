@@ -0,0 +1,188 @@
+/**
+ * @file unique_function.h
+ * @brief 只可移动、带内联存储的函数对象
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ */
+#ifndef __SYLAR_UNIQUE_FUNCTION_H__
+#define __SYLAR_UNIQUE_FUNCTION_H__
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <typeinfo>
+#include <utility>
+
+namespace sylar {
+
+template<class Sig, size_t InlineSize = 56>
+class UniqueFunction;
+
+template<class T>
+struct IsStdFunction : std::false_type {};
+template<class Sig>
+struct IsStdFunction<std::function<Sig>> : std::true_type {};
+
+/**
+ * @brief 只可移动的 std::function 替代品，用于协程和调度器的回调
+ *
+ * 与 std::function 的区别：
+ * 1、只要求可调用对象可移动，可以捕获 unique_ptr 等只可移动的对象
+ * 2、不超过 InlineSize 字节、对齐不超过 max_align_t 且移动不抛异常的可调用对象直接放在对象内部，
+ *    不分配堆内存。默认 56 字节，加上操作表指针整个对象正好 64 字节，捕获几个指针的 lambda 都能放下
+ * 3、operator() 不是 const 的，调用的就是内部保存的那一份
+ * 空对象调用抛出 std::bad_function_call
+ */
+template<class R, class... Args, size_t InlineSize>
+class UniqueFunction<R(Args...), InlineSize> {
+public:
+    UniqueFunction() noexcept = default;
+    UniqueFunction(std::nullptr_t) noexcept {}
+
+    template<class F>
+    requires (!std::same_as<std::decay_t<F>, UniqueFunction>)
+        && std::is_invocable_r_v<R, std::decay_t<F>&, Args...>
+    UniqueFunction(F&& f) {
+        typedef std::decay_t<F> Fn;
+        // 空的函数指针和空的 std::function 转成空对象，与 std::function 的语义一致
+        // 直接传函数名时 F 是函数引用，不可能为空
+        typedef std::remove_cvref_t<F> Arg;
+        if constexpr(std::is_pointer_v<Arg> || std::is_member_pointer_v<Arg>
+                || IsStdFunction<Arg>::value) {
+            if(!f) {
+                return;
+            }
+        }
+        if constexpr(IsInline<Fn>()) {
+            ::new ((void*)m_storage) Fn(std::forward<F>(f));
+        } else {
+            *reinterpret_cast<Fn**>(m_storage) = new Fn(std::forward<F>(f));
+        }
+        m_ops = &OpsFor<Fn>::s_ops;
+    }
+
+    UniqueFunction(UniqueFunction&& other) noexcept {
+        moveFrom(other);
+    }
+
+    UniqueFunction& operator=(UniqueFunction&& other) noexcept {
+        if(this != &other) {
+            clear();
+            moveFrom(other);
+        }
+        return *this;
+    }
+
+    UniqueFunction& operator=(std::nullptr_t) noexcept {
+        clear();
+        return *this;
+    }
+
+    UniqueFunction(const UniqueFunction&) = delete;
+    UniqueFunction& operator=(const UniqueFunction&) = delete;
+
+    ~UniqueFunction() {
+        clear();
+    }
+
+    explicit operator bool() const noexcept { return m_ops != nullptr;}
+
+    R operator()(Args... args) {
+        if(!m_ops) {
+            throw std::bad_function_call();
+        }
+        return m_ops->invoke(m_storage, std::forward<Args>(args)...);
+    }
+
+    /**
+     * @brief 保存的可调用对象的类型，空对象为 typeid(void)
+     */
+    const std::type_info& target_type() const noexcept {
+        return m_ops ? m_ops->type() : typeid(void);
+    }
+
+    void swap(UniqueFunction& other) noexcept {
+        UniqueFunction tmp(std::move(other));
+        other = std::move(*this);
+        *this = std::move(tmp);
+    }
+private:
+    /**
+     * @brief 按类型生成的操作表，空对象的操作表为 nullptr
+     */
+    struct Ops {
+        R (*invoke)(void* storage, Args&&... args);
+        // 从 src 移动到 dst，并销毁 src
+        void (*relocate)(void* dst, void* src) noexcept;
+        void (*destroy)(void* storage) noexcept;
+        const std::type_info& (*type)() noexcept;
+    };
+
+    template<class Fn>
+    static constexpr bool IsInline() {
+        return sizeof(Fn) <= InlineSize
+            && alignof(Fn) <= alignof(std::max_align_t)
+            && std::is_nothrow_move_constructible_v<Fn>;
+    }
+
+    template<class Fn>
+    struct OpsFor {
+        static Fn* Get(void* storage) {
+            if constexpr(IsInline<Fn>()) {
+                return std::launder(reinterpret_cast<Fn*>(storage));
+            } else {
+                return *reinterpret_cast<Fn**>(storage);
+            }
+        }
+        static R Invoke(void* storage, Args&&... args) {
+            return std::invoke(*Get(storage), std::forward<Args>(args)...);
+        }
+        static void Relocate(void* dst, void* src) noexcept {
+            if constexpr(IsInline<Fn>()) {
+                Fn* f = Get(src);
+                ::new (dst) Fn(std::move(*f));
+                f->~Fn();
+            } else {
+                // 堆上的对象只需转移指针
+                *reinterpret_cast<Fn**>(dst) = *reinterpret_cast<Fn**>(src);
+            }
+        }
+        static void Destroy(void* storage) noexcept {
+            if constexpr(IsInline<Fn>()) {
+                Get(storage)->~Fn();
+            } else {
+                delete Get(storage);
+            }
+        }
+        static const std::type_info& Type() noexcept {
+            return typeid(Fn);
+        }
+        static constexpr Ops s_ops = {&Invoke, &Relocate, &Destroy, &Type};
+    };
+
+    void moveFrom(UniqueFunction& other) noexcept {
+        if(other.m_ops) {
+            other.m_ops->relocate(m_storage, other.m_storage);
+            m_ops = other.m_ops;
+            other.m_ops = nullptr;
+        }
+    }
+
+    void clear() noexcept {
+        if(m_ops) {
+            // 先置空再销毁，可调用对象析构时再访问本对象看到的是空对象
+            const Ops* ops = m_ops;
+            m_ops = nullptr;
+            ops->destroy(m_storage);
+        }
+    }
+private:
+    alignas(std::max_align_t) unsigned char m_storage[InlineSize];
+    const Ops* m_ops = nullptr;
+};
+
+}
+
+#endif
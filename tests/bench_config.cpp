@@ -0,0 +1,184 @@
+#include "../sylar/sylar.h"
+#include <chrono>
+#include <atomic>
+#include <vector>
+#include <map>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+
+/**
+ * @brief 配置系统基准测试
+ * 输出为 CSV，每行一个用例，便于不同提交之间直接 diff / 画图：
+ *   bench,param,threads,ops,total_ms,ns_per_op,mops
+ * 用法：bench_config [scale]，scale 为迭代次数倍率（默认1）
+ */
+
+static uint64_t g_scale = 1;
+
+static uint64_t NowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void Report(const char* bench, uint64_t param, int threads, uint64_t ops, uint64_t ns) {
+    double ns_per_op = ops ? (double)ns / ops : 0;
+    double mops = ns ? (double)ops * 1000.0 / ns : 0;
+    printf("%s,%lu,%d,%lu,%.3f,%.2f,%.3f\n", bench, param, threads, ops
+            , ns / 1e6, ns_per_op, mops);
+    fflush(stdout);
+}
+
+/**
+ * @brief 启动 threads 个线程同时执行 fn(idx)，返回从放行到全部结束的耗时
+ * 线程创建的开销不计入：所有线程先就绪，再统一放行
+ */
+static uint64_t RunThreads(int threads, std::function<void(int)> fn) {
+    std::atomic<int> ready{0};
+    std::atomic<bool> go{false};
+    std::vector<sylar::Thread::ptr> thrs;
+    for(int i = 0; i < threads; ++i) {
+        thrs.push_back(std::make_shared<sylar::Thread>([&, i](){
+            ++ready;
+            while(!go) {
+            }
+            fn(i);
+        }, "bench_" + std::to_string(i)));
+    }
+    while(ready != threads) {
+    }
+    uint64_t start = NowNs();
+    go = true;
+    for(auto& i : thrs) {
+        i->join();
+    }
+    return NowNs() - start;
+}
+
+static const int s_thread_counts[] = {1, 2, 4, 8, 16, 32, 64};
+
+// 防止编译器把读到的值优化掉
+static std::atomic<uint64_t> g_sink{0};
+
+void bench_lookup() {
+    const int key_count = 1000;
+    std::vector<std::string> names;
+    for(int i = 0; i < key_count; ++i) {
+        names.push_back("bench.lookup.k" + std::to_string(i));
+        sylar::Config::Lookup(names.back(), i, "bench lookup");
+    }
+    const uint64_t per_thread = 50000 * g_scale;
+    for(int t : s_thread_counts) {
+        uint64_t ns = RunThreads(t, [&](int idx) {
+            uint64_t sum = 0;
+            for(uint64_t i = 0; i < per_thread; ++i) {
+                auto var = sylar::Config::Lookup<int>(names[(i + idx) % key_count]);
+                sum += var ? 1 : 0;
+            }
+            g_sink += sum;
+        });
+        Report("lookup", key_count, t, per_thread * t, ns);
+    }
+}
+
+void bench_get_value() {
+    auto var = sylar::Config::Lookup("bench.get_value", 1, "bench get_value");
+    const uint64_t per_thread = 1000000 * g_scale;
+    for(int t : s_thread_counts) {
+        uint64_t ns = RunThreads(t, [&](int) {
+            uint64_t sum = 0;
+            for(uint64_t i = 0; i < per_thread; ++i) {
+                sum += var->getValue();
+            }
+            g_sink += sum;
+        });
+        Report("get_value", 0, t, per_thread * t, ns);
+    }
+}
+
+void bench_load_yaml() {
+    const int key_counts[] = {100, 1000, 10000};
+    for(int n : key_counts) {
+        std::string prefix = "k" + std::to_string(n) + "_";
+        for(int i = 0; i < n; ++i) {
+            sylar::Config::Lookup("bench.load." + prefix + std::to_string(i), 0, "bench load");
+        }
+        // 两份取值不同的节点交替加载，保证每次都真正 setValue
+        YAML::Node nodes[2];
+        for(int r = 0; r < 2; ++r) {
+            for(int i = 0; i < n; ++i) {
+                nodes[r]["bench"]["load"][prefix + std::to_string(i)] = i * 2 + r;
+            }
+        }
+        uint64_t rounds = (n >= 10000 ? 5 : 50) * g_scale;
+        uint64_t start = NowNs();
+        for(uint64_t r = 0; r < rounds; ++r) {
+            sylar::Config::LoadFromYaml(nodes[r & 1]);
+        }
+        Report("load_yaml", n, 1, rounds * n, NowNs() - start);
+    }
+
+    // 嵌套容器：map<string, vector<int>>
+    typedef std::map<std::string, std::vector<int> > NestedType;
+    const int nested_vars = 100;
+    const int nested_width = 10;
+    for(int i = 0; i < nested_vars; ++i) {
+        sylar::Config::Lookup("bench.nested.v" + std::to_string(i), NestedType(), "bench nested");
+    }
+    YAML::Node nodes[2];
+    for(int r = 0; r < 2; ++r) {
+        for(int i = 0; i < nested_vars; ++i) {
+            YAML::Node m;
+            for(int j = 0; j < nested_width; ++j) {
+                YAML::Node seq;
+                for(int k = 0; k < nested_width; ++k) {
+                    seq.push_back(j * nested_width + k + r);
+                }
+                m["e" + std::to_string(j)] = seq;
+            }
+            nodes[r]["bench"]["nested"]["v" + std::to_string(i)] = m;
+        }
+    }
+    uint64_t rounds = 20 * g_scale;
+    uint64_t start = NowNs();
+    for(uint64_t r = 0; r < rounds; ++r) {
+        sylar::Config::LoadFromYaml(nodes[r & 1]);
+    }
+    Report("load_yaml_nested", nested_vars * nested_width * nested_width, 1
+            , rounds * nested_vars, NowNs() - start);
+}
+
+void bench_listener_fanout() {
+    const int listener_counts[] = {0, 1, 10, 100, 1000};
+    for(int n : listener_counts) {
+        auto var = sylar::Config::Lookup("bench.fanout.l" + std::to_string(n), 0, "bench fanout");
+        uint64_t calls = 0;
+        for(int i = 0; i < n; ++i) {
+            var->addListener([&calls](const int&, const int&) {
+                ++calls;
+            });
+        }
+        const uint64_t sets = (n >= 100 ? 10000 : 100000) * g_scale;
+        uint64_t start = NowNs();
+        for(uint64_t i = 1; i <= sets; ++i) {
+            var->setValue((int)i);
+        }
+        Report("listener_fanout", n, 1, sets, NowNs() - start);
+        g_sink += calls;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if(argc > 1) {
+        g_scale = std::max(1L, atol(argv[1]));
+    }
+    // 基准中会注册大量配置项和回调，关掉 DEBUG/INFO 输出避免干扰计时
+    SYLAR_LOG_ROOT()->setLevel(sylar::LogLevel::ERROR);
+
+    printf("bench,param,threads,ops,total_ms,ns_per_op,mops\n");
+    bench_lookup();
+    bench_get_value();
+    bench_load_yaml();
+    bench_listener_fanout();
+    return 0;
+}
@@ -0,0 +1,332 @@
+#include "../sylar/sylar.h"
+#include <chrono>
+#include <atomic>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+/**
+ * @brief 协程基准测试：上下文切换、生命周期与内存占用
+ * 每行一个用例，默认输出 CSV，便于不同提交、不同切换实现/栈分配器之间直接对比：
+ *   bench,backend,param,threads,ops,total_ms,ns_per_op,mops,bytes_per_op
+ * backend 为 "切换实现/栈分配器"，param 一般为栈大小，bytes_per_op 只有 memory 类用例有值
+ * 用法：bench_fiber [scale] [csv|json] [output]，scale 为迭代次数倍率（默认1），
+ * output 为结果文件（默认标准输出；静态初始化阶段的日志也会打到标准输出，要得到干净的 JSON 时指定文件）
+ * 切换实现由编译选项 SYLAR_FIBER_USE_ASM 决定，栈分配器由 fiber.stack_allocator 决定，
+ * 这里会依次测 malloc / pool / mmap 三种分配器
+ */
+
+static uint64_t g_scale = 1;
+static bool g_json = false;
+static FILE* g_out = stdout;
+
+struct Row {
+    std::string bench;
+    std::string backend;
+    uint64_t param;
+    int threads;
+    uint64_t ops;
+    uint64_t ns;
+    uint64_t bytes_per_op;
+};
+
+static std::vector<Row> s_rows;
+
+static uint64_t NowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static std::string Backend() {
+    return std::string(sylar::FiberContextImpl()) + "/"
+        + sylar::StackAllocator::GetDefault()->getName();
+}
+
+static void Report(const char* bench, uint64_t param, int threads, uint64_t ops
+        , uint64_t ns, uint64_t bytes_per_op = 0) {
+    Row row{bench, Backend(), param, threads, ops, ns, bytes_per_op};
+    if(g_json) {
+        s_rows.push_back(row);
+        return;
+    }
+    double ns_per_op = ops ? (double)ns / ops : 0;
+    double mops = ns ? (double)ops * 1000.0 / ns : 0;
+    fprintf(g_out, "%s,%s,%lu,%d,%lu,%.3f,%.2f,%.3f,%lu\n", bench, row.backend.c_str(), param
+            , threads, ops, ns / 1e6, ns_per_op, mops, bytes_per_op);
+    fflush(g_out);
+}
+
+static void PrintJson() {
+    fprintf(g_out, "[\n");
+    for(size_t i = 0; i < s_rows.size(); ++i) {
+        const Row& r = s_rows[i];
+        double ns_per_op = r.ops ? (double)r.ns / r.ops : 0;
+        double mops = r.ns ? (double)r.ops * 1000.0 / r.ns : 0;
+        fprintf(g_out, "  {\"bench\":\"%s\",\"backend\":\"%s\",\"param\":%lu,\"threads\":%d,\"ops\":%lu"
+                ",\"total_ms\":%.3f,\"ns_per_op\":%.2f,\"mops\":%.3f,\"bytes_per_op\":%lu}%s\n"
+                , r.bench.c_str(), r.backend.c_str(), r.param, r.threads, r.ops
+                , r.ns / 1e6, ns_per_op, mops, r.bytes_per_op
+                , i + 1 == s_rows.size() ? "" : ",");
+    }
+    fprintf(g_out, "]\n");
+}
+
+/**
+ * @brief 启动 threads 个线程同时执行 fn(idx)，返回从放行到全部结束的耗时
+ * 每个线程先创建自己的主协程并就绪，再统一放行
+ */
+static uint64_t RunThreads(int threads, std::function<void(int)> fn) {
+    std::atomic<int> ready{0};
+    std::atomic<bool> go{false};
+    std::vector<sylar::Thread::ptr> thrs;
+    for(int i = 0; i < threads; ++i) {
+        thrs.push_back(std::make_shared<sylar::Thread>([&, i](){
+            sylar::Fiber::GetThis();
+            ++ready;
+            while(!go) {
+            }
+            fn(i);
+        }, "bench_" + std::to_string(i)));
+    }
+    while(ready != threads) {
+    }
+    uint64_t start = NowNs();
+    go = true;
+    for(auto& i : thrs) {
+        i->join();
+    }
+    return NowNs() - start;
+}
+
+/**
+ * @brief 进程当前的常驻内存，字节
+ */
+static uint64_t GetRss() {
+    FILE* fp = fopen("/proc/self/statm", "r");
+    if(!fp) {
+        return 0;
+    }
+    unsigned long size = 0, resident = 0;
+    if(fscanf(fp, "%lu %lu", &size, &resident) != 2) {
+        resident = 0;
+    }
+    fclose(fp);
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+static const int s_thread_counts[] = {1, 2, 4, 8};
+static const uint32_t s_stack_sizes[] = {16 * 1024, 64 * 1024, 128 * 1024, 1024 * 1024};
+
+static std::atomic<uint64_t> g_sink{0};
+
+static thread_local sylar::FiberContext t_main_ctx;
+static thread_local sylar::FiberContext t_bench_ctx;
+
+static void ContextEntry() {
+    while(true) {
+        sylar::SwapFiberContext(&t_bench_ctx, &t_main_ctx);
+    }
+}
+
+/**
+ * @brief 裸上下文往返：只测切换实现本身，不含 Fiber 的状态维护
+ */
+void bench_context_switch() {
+    const uint64_t per_thread = 1000000 * g_scale;
+    const size_t ss = 64 * 1024;
+    for(int t : s_thread_counts) {
+        uint64_t ns = RunThreads(t, [&](int) {
+            void* stack = malloc(ss);
+            sylar::MakeFiberContext(&t_bench_ctx, stack, ss, &ContextEntry);
+            for(uint64_t i = 0; i < per_thread; ++i) {
+                sylar::SwapFiberContext(&t_main_ctx, &t_bench_ctx);
+            }
+            // 入口函数不会返回，栈上没有需要析构的对象，直接释放
+            free(stack);
+        });
+        Report("context_switch", ss, t, per_thread * t, ns);
+    }
+}
+
+/**
+ * @brief swapIn / YieldToReady 往返：协程的常规切入与让出
+ */
+void bench_yield() {
+    const uint64_t per_thread = 1000000 * g_scale;
+    for(int t : s_thread_counts) {
+        uint64_t ns = RunThreads(t, [&](int) {
+            sylar::Fiber::ptr fiber = std::make_shared<sylar::Fiber>([per_thread]() {
+                for(uint64_t i = 0; i < per_thread; ++i) {
+                    sylar::Fiber::YieldToReady();
+                }
+            }, 64 * 1024);
+            for(uint64_t i = 0; i <= per_thread; ++i) {
+                fiber->swapIn();
+            }
+        });
+        Report("swap_yield", 64 * 1024, t, per_thread * t, ns);
+    }
+}
+
+/**
+ * @brief 两个协程用 YieldTo 直接互相切换，每次切换计一次
+ */
+void bench_yield_to() {
+    const uint64_t per_thread = 1000000 * g_scale;
+    for(int t : s_thread_counts) {
+        uint64_t ns = RunThreads(t, [&](int) {
+            sylar::Fiber::ptr a, b;
+            a = std::make_shared<sylar::Fiber>([&]() {
+                for(uint64_t i = 0; i < per_thread / 2; ++i) {
+                    sylar::Fiber::YieldTo(b);
+                }
+            }, 64 * 1024);
+            b = std::make_shared<sylar::Fiber>([&]() {
+                for(uint64_t i = 0; i < per_thread / 2; ++i) {
+                    sylar::Fiber::YieldTo(a);
+                }
+            }, 64 * 1024);
+            a->swapIn();
+            b->swapIn();
+        });
+        Report("yield_to", 64 * 1024, t, per_thread * t, ns);
+    }
+}
+
+/**
+ * @brief 每个任务新建协程、运行到结束、析构
+ */
+void bench_create_destroy() {
+    const uint64_t per_thread = 100000 * g_scale;
+    for(uint32_t ss : s_stack_sizes) {
+        for(int t : s_thread_counts) {
+            uint64_t ns = RunThreads(t, [&](int) {
+                uint64_t sum = 0;
+                for(uint64_t i = 0; i < per_thread; ++i) {
+                    sylar::Fiber::ptr fiber = std::make_shared<sylar::Fiber>([&sum]() {
+                        ++sum;
+                    }, ss);
+                    fiber->swapIn();
+                }
+                g_sink += sum;
+            });
+            Report("create_destroy", ss, t, per_thread * t, ns);
+        }
+    }
+}
+
+/**
+ * @brief 同一个协程对象 reset 后运行下一个任务
+ */
+void bench_reset_reuse() {
+    const uint64_t per_thread = 100000 * g_scale;
+    for(uint32_t ss : s_stack_sizes) {
+        for(int t : s_thread_counts) {
+            uint64_t ns = RunThreads(t, [&](int) {
+                uint64_t sum = 0;
+                sylar::Fiber::ptr fiber = std::make_shared<sylar::Fiber>(nullptr, ss);
+                for(uint64_t i = 0; i < per_thread; ++i) {
+                    fiber->reset([&sum]() {
+                        ++sum;
+                    });
+                    fiber->swapIn();
+                }
+                g_sink += sum;
+            });
+            Report("reset_reuse", ss, t, per_thread * t, ns);
+        }
+    }
+}
+
+// memory 类用例中每个协程用到的栈深度
+static constexpr size_t LIVE_STACK_DEPTH = 2048;
+
+/**
+ * @brief 把池化分配器缓存的栈还给系统，避免复用已常驻的栈让内存增量偏小
+ */
+static void TrimAllocator() {
+    auto pool = dynamic_cast<sylar::PooledStackAllocator*>(sylar::StackAllocator::GetDefault());
+    if(pool) {
+        pool->trim();
+    }
+}
+
+/**
+ * @brief N 个挂起中的协程的内存占用，每个协程用了约 LIVE_STACK_DEPTH 字节的栈
+ * bytes_per_op 为常驻内存的增量除以协程数，ns_per_op 为创建并运行到第一次挂起的耗时
+ */
+static void MeasureLive(const char* bench, uint32_t ss, bool shared, uint64_t count) {
+    TrimAllocator();
+    std::vector<sylar::Fiber::ptr> fibers;
+    fibers.reserve(count);
+    uint64_t rss = GetRss();
+    uint64_t start = NowNs();
+    for(uint64_t i = 0; i < count; ++i) {
+        fibers.push_back(std::make_shared<sylar::Fiber>([]() {
+            char buf[LIVE_STACK_DEPTH];
+            memset(buf, 1, sizeof(buf));
+            sylar::Fiber::YieldToReady();
+            g_sink += buf[LIVE_STACK_DEPTH / 2];
+        }, ss, false, shared));
+        fibers.back()->swapIn();
+    }
+    uint64_t ns = NowNs() - start;
+    uint64_t used = GetRss();
+    used = used > rss ? used - rss : 0;
+    Report(bench, ss, 1, count, ns, used / count);
+    for(auto& i : fibers) {
+        i->swapIn();
+    }
+}
+
+void bench_memory() {
+    sylar::Fiber::GetThis();
+    const uint64_t count = 2000 * g_scale;
+    for(uint32_t ss : s_stack_sizes) {
+        MeasureLive("memory_live", ss, false, count);
+    }
+    MeasureLive("memory_live_shared", 0, true, count);
+}
+
+int main(int argc, char* argv[]) {
+    if(argc > 1) {
+        g_scale = std::max(1L, atol(argv[1]));
+    }
+    if(argc > 2) {
+        g_json = !strcmp(argv[2], "json");
+    }
+    if(argc > 3) {
+        g_out = fopen(argv[3], "w");
+        if(!g_out) {
+            perror(argv[3]);
+            return 1;
+        }
+    }
+    // 协程的创建析构会打 DEBUG 日志，关掉避免干扰计时
+    SYLAR_LOG_ROOT()->setLevel(sylar::LogLevel::ERROR);
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::ERROR);
+
+    if(!g_json) {
+        fprintf(g_out, "bench,backend,param,threads,ops,total_ms,ns_per_op,mops,bytes_per_op\n");
+    }
+    auto allocator = sylar::Config::Lookup<std::string>("fiber.stack_allocator");
+    for(const char* name : {"malloc", "pool", "mmap"}) {
+        allocator->setValue(name);
+        bench_context_switch();
+        bench_yield();
+        bench_yield_to();
+        bench_create_destroy();
+        bench_reset_reuse();
+        bench_memory();
+    }
+    if(g_json) {
+        PrintJson();
+    }
+    if(g_out != stdout) {
+        fclose(g_out);
+    }
+    return 0;
+}
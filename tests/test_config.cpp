@@ -7,6 +7,11 @@
  */
 #include <iostream>
 #include "../sylar/config.h"
+#include "../sylar/config_key.h"
+#include "../sylar/config_watcher.h"
+#include "../sylar/scheduler.h"
+#include <fstream>
+#include <sys/stat.h>
 #include "../sylar/log.h"
 // 测试yaml的路径
 const std::string testPath = "../bin/conf/test.yml";
@@ -241,7 +246,170 @@ void test_log() {
 }
 
 
+// 编译期配置键测试，名字写错（比如含大写或空格）会直接编译失败
+typedef sylar::ConfigKey<"key.port", int> PortKey;
+typedef sylar::ConfigKey<"key.timeout_ms", uint64_t> TimeoutKey;
+typedef sylar::ConfigSchema<PortKey, TimeoutKey> KeySchema;
+
+static auto g_key_port = PortKey::Define(8080, "key port");
+static auto g_key_timeout = TimeoutKey::Define(3000, "key timeout");
+
+void test_config_key() {
+    static_assert(KeySchema::IndexOf<TimeoutKey>() == 1);
+    static_assert(KeySchema::IndexOf("key.port") == 0);
+    static_assert(KeySchema::IndexOf("key.none") == -1);
+
+    SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "PortKey::Get(): " << PortKey::Get()->getValue()
+        << " Find(key.timeout_ms): " << KeySchema::Find("key.timeout_ms")->toString()
+        << " seed: " << KeySchema::seed;
+    // 与运行时 Lookup 拿到的是同一个对象
+    SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "same var: "
+        << (sylar::Config::Lookup<int>("key.port") == PortKey::Get());
+}
+
+// 事务式加载 + 目录监听测试
+void test_watcher() {
+    const std::string dir = "/tmp/sylar_test_conf";
+    mkdir(dir.c_str(), 0755);
+    auto write_conf = [&dir](int port, int timeout) {
+        std::ofstream ofs(dir + "/watch.yml", std::ios::trunc);
+        ofs << "key:\n    port: " << port << "\n    timeout_ms: " << timeout << "\n";
+    };
+    write_conf(1000, 1000);
+    sylar::Config::LoadFromConfDir(dir);
+
+    // 回调触发时，另一个配置项也已经是新值
+    g_key_port->addListener([](const int& old_value, const int& new_value) {
+        SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "port " << old_value << " -> " << new_value
+            << ", timeout already=" << g_key_timeout->getValue();
+    });
+    uint64_t id = sylar::Config::AddReloadListener([](const std::vector<std::string>& names) {
+        SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "reload, changed=" << names.size();
+    });
+
+    sylar::ConfigWatcher watcher(dir, 100);
+    watcher.start();
+    // 连续写三次，防抖后只加载一次
+    for(int i = 1; i <= 3; ++i) {
+        write_conf(2000 + i, 5000 + i);
+    }
+    sleep(1);
+    SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "reload count=" << watcher.getReloadCount()
+        << " port=" << g_key_port->getValue() << " timeout=" << g_key_timeout->getValue();
+
+    // 语法错误的文件整体回滚
+    {
+        std::ofstream ofs(dir + "/watch.yml", std::ios::trunc);
+        ofs << "key: [port: 1\n";
+    }
+    sleep(1);
+    SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "after bad file, port=" << g_key_port->getValue();
+    watcher.stop();
+    sylar::Config::DelReloadListener(id);
+
+    // reload 回调中再次加载配置，事务锁已经释放，不会死锁
+    static int s_depth = 0;
+    id = sylar::Config::AddReloadListener([](const std::vector<std::string>&) {
+        if(++s_depth == 1) {
+            sylar::Config::LoadFromYamls({YAML::Load("key:\n    timeout_ms: 3001")});
+        }
+    });
+    sylar::Config::LoadFromYamls({YAML::Load("key:\n    port: 3000")});
+    SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "reentrant reload depth=" << s_depth
+        << " port=" << g_key_port->getValue() << " timeout=" << g_key_timeout->getValue();
+    sylar::Config::DelReloadListener(id);
+}
+
+// 回调异步派发到调度器测试
+void test_async_listener() {
+    static sylar::ConfigVar<int>::ptr var =
+        sylar::Config::Lookup("async.value", (int)0, "async value");
+    sylar::Scheduler sc(1, false, "listener");
+    sc.start();
+    var->setListenerScheduler(&sc);
+    var->addListener([](const int& old_value, const int& new_value) {
+        // 模拟慢回调，setValue 不会被阻塞
+        usleep(100 * 1000);
+        SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "async listener " << old_value << " -> " << new_value;
+    });
+    // 回调执行期间的连续修改会合并成一次通知
+    for(int i = 1; i <= 10; ++i) {
+        var->setValue(i);
+    }
+    SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "setValue done, value=" << var->getValue();
+    sleep(1);
+    // 调度器停止后不再接受任务，回调在 setValue 的线程中同步执行，之后的修改照常通知
+    sc.stop();
+    var->setValue(11);
+    var->setValue(12);
+    var->setListenerScheduler(nullptr);
+}
+
+// 二进制快照测试
+void test_snapshot() {
+    const std::string dir = "/tmp/sylar_test_snapshot";
+    const std::string snap = dir + "/config.snapshot";
+    mkdir(dir.c_str(), 0755);
+    {
+        std::ofstream ofs(dir + "/snap.yml", std::ios::trunc);
+        ofs << "key:\n    port: 7001\n    timeout_ms: 7002\n"
+            << "system:\n    int_vec: [7, 8, 9]\n";
+    }
+    unlink(snap.c_str());
+    // 第一次没有快照，回退到 yml 并生成快照；yml 中没有的配置项（运行时修改过的值）不进快照
+    float value = g_float_value_config->getValue();
+    g_float_value_config->setValue(1.5f);
+    bool from_snapshot = sylar::Config::LoadFromSnapshot(snap, dir);
+    sylar::Config::LoadFromConfDir(dir, snap);
+    SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "first load from_snapshot=" << from_snapshot
+        << " port=" << g_key_port->getValue();
+    g_float_value_config->setValue(value);
+
+    g_key_port->setValue(1);
+    g_int_vec_value_config->setValue({1});
+    from_snapshot = sylar::Config::LoadFromSnapshot(snap, dir);
+    SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "second load from_snapshot=" << from_snapshot
+        << " port=" << g_key_port->getValue()
+        << " int_vec=" << g_int_vec_value_config->toString()
+        << " value kept=" << (g_float_value_config->getValue() == value);
+
+    // yml 修改后快照过期
+    sleep(1);
+    {
+        std::ofstream ofs(dir + "/snap.yml", std::ios::app);
+        ofs << "    port: 7003\n";
+    }
+    from_snapshot = sylar::Config::LoadFromSnapshot(snap, dir);
+    SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "after modify from_snapshot=" << from_snapshot;
+}
+
+void test_diff_listener() {
+    typedef std::map<std::string, int> RouteMap;
+    static sylar::ConfigVar<RouteMap>::ptr var =
+        sylar::Config::Lookup("diff.routes", RouteMap{{"a", 1}, {"b", 2}, {"c", 3}}, "diff routes");
+    var->addDiffListener([](const sylar::ConfigDiff<RouteMap>& diff) {
+        for(auto& i : diff.added) {
+            SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "diff added " << i.first << "=" << i.second;
+        }
+        for(auto& i : diff.removed) {
+            SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "diff removed " << i.first << "=" << i.second;
+        }
+        for(auto& i : diff.changed) {
+            SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "diff changed " << i.key << ": "
+                << i.old_value << " -> " << i.new_value;
+        }
+    });
+    // 删除 a，修改 b，增加 d，c 不变
+    var->setValue(RouteMap{{"b", 20}, {"c", 3}, {"d", 4}});
+}
+
 int main(int argc, char* argv[]) {
+    test_config_key();
+    test_watcher();
+    test_async_listener();
+    test_snapshot();
+    test_diff_listener();
+
     // test_yaml();
 
     // test_config();
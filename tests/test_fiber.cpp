@@ -22,6 +22,167 @@ void test_fiber() {
     SYLAR_LOG_INFO(g_logger) << "main end.";
 }
 
+void test_shared_stack() {
+    sylar::Fiber::GetThis();
+    const int count = 1000;
+    int ok = 0;
+    std::vector<sylar::Fiber::ptr> fibers;
+    for(int i = 0; i < count; ++i) {
+        // 共享栈协程：栈上的局部变量在挂起期间被拷走，恢复后内容和地址都不变
+        fibers.push_back(std::make_shared<sylar::Fiber>([i, &ok]() {
+            char buf[256];
+            memset(buf, i & 0xff, sizeof(buf));
+            char* addr = buf;
+            sylar::Fiber::GetThis()->YieldToReady();
+            bool same = (addr == buf);
+            for(size_t j = 0; j < sizeof(buf); ++j) {
+                same = same && (buf[j] == (char)(i & 0xff));
+            }
+            ok += same;
+        }, 0, false, true));
+    }
+    // 交替切入，每次切入都会把上一个协程的栈拷走
+    for(auto& i : fibers) {
+        i->swapIn();
+    }
+    for(auto& i : fibers) {
+        i->swapIn();
+    }
+    SYLAR_LOG_INFO(g_logger) << "shared stack fibers ok " << ok << "/" << count;
+}
+
+struct LocalCounter {
+    ~LocalCounter() { ++s_destroyed;}
+    int value = 0;
+    static int s_destroyed;
+};
+int LocalCounter::s_destroyed = 0;
+
+static sylar::FiberLocal<LocalCounter> s_counter;
+static sylar::FiberLocal<std::string> s_name;
+
+void test_fiber_local() {
+    sylar::Fiber::GetThis();
+    s_name.set("main");
+    std::vector<sylar::Fiber::ptr> fibers;
+    int ok = 0;
+    for(int i = 0; i < 10; ++i) {
+        fibers.push_back(std::make_shared<sylar::Fiber>([i, &ok]() {
+            // 每个协程看到的都是自己的值
+            s_counter->value = i;
+            s_name.set("fiber-" + std::to_string(i));
+            sylar::Fiber::GetThis()->YieldToReady();
+            ok += (s_counter->value == i && *s_name == "fiber-" + std::to_string(i));
+        }));
+    }
+    for(auto& i : fibers) {
+        i->swapIn();
+    }
+    for(auto& i : fibers) {
+        i->swapIn();
+    }
+    // 协程结束时已销毁各自的值，主协程的值不受影响
+    SYLAR_LOG_INFO(g_logger) << "fiber local ok " << ok << "/10 destroyed="
+        << LocalCounter::s_destroyed << " main=" << *s_name;
+}
+
+void test_stack_check() {
+    sylar::Fiber::GetThis();
+    // 只对打开之后创建的协程生效
+    sylar::Config::Lookup<bool>("fiber.stack_check")->setValue(true);
+    sylar::Fiber::ResetStackStats();
+    auto deep = []() {
+        char buf[32 * 1024];
+        memset(buf, 1, sizeof(buf));
+        sylar::Fiber::GetThis()->YieldToReady();
+        SYLAR_LOG_DEBUG(g_logger) << (int)buf[100];
+    };
+    auto shallow = []() {
+        sylar::Fiber::GetThis()->YieldToReady();
+    };
+    sylar::Fiber::ptr fiber = std::make_shared<sylar::Fiber>(deep, 128 * 1024);
+    for(int i = 0; i < 3; ++i) {
+        fiber->swapIn();
+        fiber->swapIn();
+        // reset 只重新填充上次用到的部分
+        if(i % 2) {
+            fiber->reset(deep);
+        } else {
+            fiber->reset(shallow);
+        }
+    }
+    sylar::Config::Lookup<bool>("fiber.stack_check")->setValue(false);
+    for(auto& i : sylar::Fiber::GetStackStats()) {
+        SYLAR_LOG_INFO(g_logger) << "stack stats entry=" << i.entry
+            << " count=" << i.count << " stack_size=" << i.stack_size
+            << " max_used=" << i.max_used << " avg_used=" << i.total_used / i.count;
+    }
+}
+
+void test_yield_to() {
+    sylar::Fiber::GetThis();
+    const int rounds = 10000;
+    int ping = 0, pong = 0;
+    sylar::Fiber::ptr a, b;
+    // 两个协程直接互相切换，不经过主协程
+    a = std::make_shared<sylar::Fiber>([&]() {
+        for(int i = 0; i < rounds; ++i) {
+            ++ping;
+            sylar::Fiber::YieldTo(b);
+        }
+    });
+    b = std::make_shared<sylar::Fiber>([&]() {
+        for(int i = 0; i < rounds; ++i) {
+            ++pong;
+            sylar::Fiber::YieldTo(a);
+        }
+    });
+    // a 结束时回到主协程，b 停在最后一次 YieldTo 之后
+    a->swapIn();
+    b->swapIn();
+    SYLAR_LOG_INFO(g_logger) << "yield to ping=" << ping << " pong=" << pong
+        << " a=" << a->getState() << " b=" << b->getState();
+}
+
+static size_t CountOf(const std::string& str, const std::string& sub) {
+    size_t n = 0;
+    for(size_t pos = str.find(sub); pos != std::string::npos; pos = str.find(sub, pos + 1)) {
+        ++n;
+    }
+    return n;
+}
+
+void test_trace(const char* path) {
+    sylar::Config::Lookup<bool>("fiber.trace")->setValue(true);
+    sylar::FiberTrace::Clear();
+    {
+        sylar::Scheduler sc(2, false, "trace");
+        sc.start();
+        for(int i = 0; i < 8; ++i) {
+            sc.schedule([]() {
+                for(int j = 0; j < 3; ++j) {
+                    sylar::Scheduler::GetThis()->schedule(sylar::Fiber::GetThis(), sylar::GetThreadId());
+                    sylar::Fiber::YieldToReady();
+                }
+            });
+        }
+        sc.stop();
+    }
+    sylar::Config::Lookup<bool>("fiber.trace")->setValue(false);
+
+    std::stringstream ss;
+    size_t events = sylar::FiberTrace::ExportChromeJson(ss);
+    std::string json = ss.str();
+    SYLAR_LOG_INFO(g_logger) << "trace events>0=" << (events > 0)
+        << " yields=" << CountOf(json, "\"name\":\"yield\"")
+        << " named_threads=" << CountOf(json, "\"name\":\"trace_")
+        << " slices>=32=" << (CountOf(json, "\"ph\":\"X\"") >= 32);
+    if(path) {
+        // 可以用 chrome://tracing 或 ui.perfetto.dev 打开
+        sylar::FiberTrace::ExportChromeJson(path);
+    }
+}
+
 int main(int argc, char* argv[]) {
     sylar::Thread::SetName("main");
 
@@ -36,5 +197,11 @@ int main(int argc, char* argv[]) {
     for(auto i : thrs) {
         i->join();
     }
+
+    test_shared_stack();
+    test_fiber_local();
+    test_stack_check();
+    test_yield_to();
+    test_trace(argc > 1 ? argv[1] : nullptr);
     return 0;
 }
\ No newline at end of file
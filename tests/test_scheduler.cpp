@@ -1,4 +1,5 @@
 #include "../sylar/sylar.h"
+#include <deque>
 
 sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
 
@@ -19,6 +20,474 @@ void test_fiber() {
     }
 }
 
+static std::atomic<int> s_yield_tasks{200};
+
+void test_yield_task() {
+    // 把自己重新加入任务队列后让出，之后作为 fiber 任务被调度到结束
+    for(int i = 0; i < 3; ++i) {
+        sylar::Scheduler::GetThis()->schedule(sylar::Fiber::GetThis(), sylar::GetThreadId());
+        sylar::Fiber::YieldToReady();
+    }
+    // 结束前放入下一个任务，它能复用已结束的协程
+    if(--s_yield_tasks >= 20) {
+        sylar::Scheduler::GetThis()->schedule(&test_yield_task);
+    }
+}
+
+void test_handoff() {
+    // 唤醒的协程在本线程紧接着运行，不进任务队列
+    pid_t tid = sylar::GetThreadId();
+    sylar::Fiber::ptr fiber = std::make_shared<sylar::Fiber>([tid]() {
+        SYLAR_LOG_INFO(g_logger) << "handoff fiber run, same thread=" << (tid == sylar::GetThreadId());
+    });
+    sylar::Scheduler::GetThis()->scheduleHandoff(fiber);
+}
+
+void test_fiber_mutex() {
+    sylar::Scheduler sc(3, false, "mutex");
+    sc.start();
+
+    sylar::FiberMutex mutex;
+    sylar::FiberSemaphore done(0);
+    int counter = 0;
+    const int fibers = 50;
+    const int loops = 200;
+    for(int i = 0; i < fibers; ++i) {
+        sc.schedule([&]() {
+            for(int j = 0; j < loops; ++j) {
+                sylar::FiberMutex::Lock lock(mutex);
+                ++counter;
+                if(j % 50 == 0) {
+                    // 持锁让出，制造竞争：其他协程在锁上挂起，而不是阻塞调度线程
+                    sylar::Scheduler::GetThis()->schedule(sylar::Fiber::GetThis());
+                    sylar::Fiber::YieldToReady();
+                }
+            }
+            done.notify();
+        });
+    }
+    // 普通线程同时使用同一把锁，等待时阻塞的是线程
+    for(int j = 0; j < loops; ++j) {
+        sylar::FiberMutex::Lock lock(mutex);
+        ++counter;
+    }
+    for(int i = 0; i < fibers; ++i) {
+        done.wait();
+    }
+    SYLAR_LOG_INFO(g_logger) << "fiber mutex counter=" << counter
+        << " expect=" << (fibers + 1) * loops;
+
+    // 条件变量：线程生产，协程消费
+    std::deque<int> queue;
+    sylar::FiberCondition cond;
+    const int consumers = 4;
+    const int items = 1000;
+    std::atomic<long> sum{0};
+    for(int i = 0; i < consumers; ++i) {
+        sc.schedule([&]() {
+            while(true) {
+                int v;
+                {
+                    sylar::FiberMutex::Lock lock(mutex);
+                    cond.wait(mutex, [&]() { return !queue.empty();});
+                    v = queue.front();
+                    queue.pop_front();
+                }
+                if(v < 0) {
+                    break;
+                }
+                sum += v;
+            }
+            done.notify();
+        });
+    }
+    for(int i = 1; i <= items + consumers; ++i) {
+        {
+            sylar::FiberMutex::Lock lock(mutex);
+            queue.push_back(i <= items ? i : -1);
+        }
+        cond.notifyOne();
+    }
+    for(int i = 0; i < consumers; ++i) {
+        done.wait();
+    }
+    SYLAR_LOG_INFO(g_logger) << "fiber condition sum=" << sum
+        << " expect=" << (long)items * (items + 1) / 2;
+    sc.stop();
+}
+
+void test_channel() {
+    sylar::Scheduler sc(3, false, "channel");
+    sc.start();
+
+    // 流水线：生产协程 -> 有界通道 -> 加工协程 -> 无界通道 -> 主线程批量接收
+    auto input = std::make_shared<sylar::Channel<int> >(8);
+    auto output = std::make_shared<sylar::Channel<long> >();
+    const int producers = 4;
+    const int workers = 3;
+    const int items = 2000;
+    std::atomic<int> producing{producers};
+    std::atomic<int> working{workers};
+    for(int i = 0; i < producers; ++i) {
+        sc.schedule([&, i]() {
+            for(int j = i; j < items; j += producers) {
+                input->send(j + 1);
+            }
+            if(--producing == 0) {
+                input->close();
+            }
+        });
+    }
+    for(int i = 0; i < workers; ++i) {
+        sc.schedule([&]() {
+            int v;
+            while(input->recv(v)) {
+                output->send((long)v * 2);
+            }
+            if(--working == 0) {
+                output->close();
+            }
+        });
+    }
+    std::vector<long> batch;
+    long sum = 0;
+    size_t batches = 0;
+    while(output->recvMany(batch, 64)) {
+        ++batches;
+        for(auto v : batch) {
+            sum += v;
+        }
+        batch.clear();
+    }
+    SYLAR_LOG_INFO(g_logger) << "channel pipeline sum=" << sum
+        << " expect=" << (long)items * (items + 1) << " batches=" << batches
+        << " send after close=" << input->send(1);
+
+    // select：同时等待两个通道，两个都关闭后返回-1
+    auto a = std::make_shared<sylar::Channel<int> >(1);
+    auto b = std::make_shared<sylar::Channel<std::string> >(1);
+    sc.schedule([a]() {
+        for(int i = 0; i < 100; ++i) {
+            a->send(i);
+        }
+        a->close();
+    });
+    sc.schedule([b]() {
+        for(int i = 0; i < 100; ++i) {
+            b->send(std::to_string(i));
+        }
+        b->close();
+    });
+    int from_a = 0, from_b = 0;
+    sylar::FiberSemaphore done(0);
+    sc.schedule([&]() {
+        while(true) {
+            sylar::ChannelSelect sel;
+            sel.recv(a, [&](int) { ++from_a;})
+               .recv(b, [&](std::string) { ++from_b;});
+            if(sel.wait() < 0) {
+                break;
+            }
+        }
+        done.notify();
+    });
+    done.wait();
+    SYLAR_LOG_INFO(g_logger) << "channel select from_a=" << from_a << " from_b=" << from_b;
+    sc.stop();
+}
+
+static sylar::Task<int> AddOnScheduler(sylar::Scheduler* sc, int a, int b) {
+    // 切到调度线程上继续执行
+    co_await sylar::ResumeOn(sc);
+    co_return a + b;
+}
+
+static sylar::Task<> SumTask(sylar::Scheduler* sc, int i, std::atomic<long>* sum
+        , std::atomic<int>* remain, sylar::FiberSemaphore* done) {
+    int v = co_await AddOnScheduler(sc, i, i);
+    *sum += v;
+    if(--*remain == 0) {
+        done->notify();
+    }
+}
+
+static sylar::Task<int> ThrowTask() {
+    throw std::runtime_error("task error");
+    co_return 0;
+}
+
+static sylar::Task<> HoldTask(std::shared_ptr<int> held) {
+    co_return;
+}
+
+static sylar::Task<> ResumeOnTask(sylar::Scheduler* sc, bool* resumed) {
+    co_await sylar::ResumeOn(sc);
+    *resumed = true;
+}
+
+void test_coroutine_task() {
+    sylar::Scheduler sc(2, false, "task");
+    sc.start();
+
+    // 大量无栈协程与回调任务一起跑在同一个任务队列上
+    const int count = 10000;
+    std::atomic<long> sum{0};
+    std::atomic<int> remain{count};
+    sylar::FiberSemaphore done(0);
+    for(int i = 1; i <= count; ++i) {
+        sylar::Spawn(&sc, SumTask(&sc, i, &sum, &remain, &done));
+    }
+    sc.schedule([]() {
+        SYLAR_LOG_INFO(g_logger) << "callback task between coroutine tasks";
+    });
+    done.wait();
+    SYLAR_LOG_INFO(g_logger) << "coroutine task sum=" << sum
+        << " expect=" << (long)count * (count + 1)
+        << " fibers created=" << sc.getFibersCreated();
+
+    SYLAR_LOG_INFO(g_logger) << "coroutine sync wait=" << sylar::SyncWait(&sc, AddOnScheduler(&sc, 20, 22));
+    try {
+        sylar::SyncWait(&sc, ThrowTask());
+    } catch(const std::exception& e) {
+        SYLAR_LOG_INFO(g_logger) << "coroutine task exception: " << e.what();
+    }
+    sc.stop();
+
+    // 调度器停止后：Spawn 失败并销毁协程帧，ResumeOn 在当前线程上继续
+    auto held = std::make_shared<int>(0);
+    bool spawned = sylar::Spawn(&sc, HoldTask(held));
+    bool resumed = false;
+    ResumeOnTask(&sc, &resumed).detach().resume();
+    SYLAR_LOG_INFO(g_logger) << "coroutine after stop spawned=" << spawned
+        << " frame freed=" << (held.use_count() == 1) << " resumed inline=" << resumed;
+}
+
+static sylar::Task<> AwaitFuture(sylar::Future<int> f, sylar::Promise<int>* out) {
+    int v = co_await f;
+    out->setValue(v + 1);
+}
+
+void test_future() {
+    sylar::Scheduler sc(2, false, "future");
+    sc.start();
+
+    // 普通线程等待结果：阻塞线程
+    auto f = sc.scheduleWithResult([]() { return 6 * 7;});
+    SYLAR_LOG_INFO(g_logger) << "future get=" << f.get();
+
+    // 子协程中等待结果：挂起协程，调度线程继续执行其他任务
+    auto outer = sc.scheduleWithResult([&sc]() {
+        std::vector<sylar::Future<int> > futures;
+        for(int i = 1; i <= 100; ++i) {
+            futures.push_back(sc.scheduleWithResult([i]() { return i;}));
+        }
+        long sum = 0;
+        for(auto& i : futures) {
+            sum += i.get();
+        }
+        return sum;
+    });
+    SYLAR_LOG_INFO(g_logger) << "future in fiber sum=" << outer.get() << " expect=5050";
+
+    // 续延与组合
+    auto chained = sc.scheduleWithResult([]() { return std::string("sylar");})
+        .then([](const std::string& s) { return s.size();})
+        .then(&sc, [](size_t n) { return n * 10;});
+    SYLAR_LOG_INFO(g_logger) << "future then=" << chained.get();
+
+    std::vector<sylar::Future<int> > all;
+    for(int i = 0; i < 10; ++i) {
+        all.push_back(sc.scheduleWithResult([i]() { return i * i;}));
+    }
+    auto squares = sylar::WhenAll(all).get();
+    int total = 0;
+    for(auto v : squares) {
+        total += v;
+    }
+    SYLAR_LOG_INFO(g_logger) << "future when_all size=" << squares.size() << " total=" << total;
+
+    sylar::Promise<int> never;
+    std::vector<sylar::Future<int> > any{never.getFuture(), sylar::MakeReadyFuture(1)};
+    SYLAR_LOG_INFO(g_logger) << "future when_any index=" << sylar::WhenAny(any).get();
+
+    // 异常在 get() 时重新抛出，经过 then 时原样传递
+    auto failed = sc.scheduleWithResult([]() -> int {
+        throw std::runtime_error("future error");
+    }).then([](int v) { return v + 1;});
+    try {
+        failed.get();
+    } catch(const std::exception& e) {
+        SYLAR_LOG_INFO(g_logger) << "future exception: " << e.what();
+    }
+
+    // 无栈协程中 co_await Future
+    sylar::Promise<int> result;
+    sylar::Spawn(&sc, AwaitFuture(sc.scheduleWithResult([]() { return 99;}), &result));
+    SYLAR_LOG_INFO(g_logger) << "future co_await=" << result.getFuture().get();
+    sc.stop();
+}
+
+void test_cancellation() {
+    sylar::Scheduler sc(2, false, "cancel");
+    sc.start();
+
+    // 让出点检查：不停 yield 的协程在取消后结束
+    auto token = sylar::CancellationToken::Create();
+    std::atomic<int> loops{0};
+    sylar::Fiber::ptr spinner = std::make_shared<sylar::Fiber>([&]() {
+        while(true) {
+            ++loops;
+            // 固定在本线程：其他线程可能在上下文保存完之前就切入
+            sylar::Scheduler::GetThis()->schedule(sylar::Fiber::GetThis(), sylar::GetThreadId());
+            sylar::Fiber::YieldToReady();
+        }
+    });
+    spinner->setCancellationToken(token);
+    sc.schedule(spinner);
+    usleep(10 * 1000);
+    token->cancel();
+    while(spinner->getState() != sylar::Fiber::TERM) {
+        usleep(1000);
+    }
+    SYLAR_LOG_INFO(g_logger) << "cancel spinner stopped, state=TERM loops>0=" << (loops > 0);
+
+    // 派生的任务显式继承令牌；挂起在 Channel、Future 上的等待被打断；取消后派生的任务不再执行
+    auto request = sylar::CancellationToken::Create();
+    auto ch = std::make_shared<sylar::Channel<int> >(1);
+    sylar::Promise<int> never;
+    auto never_future = never.getFuture();
+    std::atomic<int> interrupted{0};
+    std::atomic<int> late_ran{0};
+    std::atomic<int> started{0};
+    sc.schedule([&]() {
+        sylar::Fiber::GetThis()->setCancellationToken(request);
+        for(int i = 0; i < 4; ++i) {
+            sc.schedule([&, i]() {
+                ++started;
+                try {
+                    if(i % 2) {
+                        int v;
+                        ch->recv(v);
+                    } else {
+                        never_future.get();
+                    }
+                } catch(const sylar::CancelledError&) {
+                    ++interrupted;
+                    sc.schedule([&]() { ++late_ran;}, -1, sylar::Fiber::GetCancellationTokenOfThis());
+                }
+            }, -1, sylar::Fiber::GetCancellationTokenOfThis());
+        }
+    });
+    while(started != 4) {
+        usleep(1000);
+    }
+    usleep(10 * 1000);
+    request->cancel();
+    while(interrupted != 4) {
+        usleep(1000);
+    }
+    usleep(10 * 1000);
+    SYLAR_LOG_INFO(g_logger) << "cancel interrupted waits=" << interrupted << " late tasks ran=" << late_ran;
+
+    // 不传令牌的任务不受调度者的令牌影响；带已取消令牌的 scheduleWithResult 结果为 CancelledError
+    sylar::Semaphore plain_done(0);
+    sc.schedule([&]() {
+        sylar::Fiber::GetThis()->setCancellationToken(request);
+        sc.schedule([&]() { plain_done.notify();});
+    });
+    plain_done.wait();
+    auto dropped = sc.scheduleWithResult([]() { return 1;}, -1, request);
+    bool dropped_cancelled = false;
+    try {
+        dropped.get();
+    } catch(const sylar::CancelledError&) {
+        dropped_cancelled = true;
+    }
+    SYLAR_LOG_INFO(g_logger) << "cancel plain task ran, dropped result cancelled=" << dropped_cancelled;
+
+    // 截止时间：子令牌沿用父令牌的截止时间，在让出点生效
+    uint64_t start = sylar::CancellationToken::NowMs();
+    auto parent = sylar::CancellationToken::Create(20);
+    auto child = parent->createChild(1000);
+    sylar::Fiber::ptr timed = std::make_shared<sylar::Fiber>([]() {
+        while(true) {
+            sylar::Scheduler::GetThis()->schedule(sylar::Fiber::GetThis(), sylar::GetThreadId());
+            sylar::Fiber::YieldToReady();
+        }
+    });
+    timed->setCancellationToken(child);
+    sc.schedule(timed);
+    while(timed->getState() != sylar::Fiber::TERM) {
+        usleep(1000);
+    }
+    uint64_t elapsed = sylar::CancellationToken::NowMs() - start;
+    SYLAR_LOG_INFO(g_logger) << "cancel deadline child stopped in_time=" << (elapsed >= 20 && elapsed < 500);
+    sc.stop();
+}
+
+void test_affinity() {
+    sylar::Scheduler sc(3, false, "affinity");
+    sc.start();
+
+    // PINNED：运行过之后 schedule(GetThis()) 自动固定到当前线程，不会被其他线程切入
+    std::atomic<int> moved{0};
+    std::atomic<int> done{0};
+    for(int i = 0; i < 4; ++i) {
+        sylar::Fiber::ptr f = std::make_shared<sylar::Fiber>([&]() {
+            pid_t tid = sylar::GetThreadId();
+            for(int j = 0; j < 200; ++j) {
+                sylar::Scheduler::GetThis()->schedule(sylar::Fiber::GetThis());
+                sylar::Fiber::YieldToReady();
+                if(sylar::GetThreadId() != tid) {
+                    ++moved;
+                }
+            }
+            ++done;
+        });
+        f->setAffinity(sylar::Fiber::AFFINITY_PINNED);
+        sc.schedule(f);
+    }
+    while(done != 4) {
+        usleep(1000);
+    }
+    uint64_t resumes = 0;
+    uint64_t migrations = 0;
+    for(auto& i : sc.getThreadStats()) {
+        resumes += i.resumes;
+        migrations += i.migrations;
+    }
+    SYLAR_LOG_INFO(g_logger) << "affinity pinned moved=" << moved
+        << " resumes=" << resumes << " migrations=" << migrations;
+
+    // PREFER_LAST：首选线程忙时其他线程等待 scheduler.affinity.steal_us 后才能取走
+    done = 0;
+    for(int i = 0; i < 4; ++i) {
+        sylar::Fiber::ptr f = std::make_shared<sylar::Fiber>([&]() {
+            for(int j = 0; j < 200; ++j) {
+                sylar::Scheduler::GetThis()->schedule(sylar::Fiber::GetThis());
+                sylar::Fiber::YieldToReady();
+            }
+            ++done;
+        });
+        f->setAffinity(sylar::Fiber::AFFINITY_PREFER_LAST);
+        sc.schedule(f);
+    }
+    while(done != 4) {
+        usleep(1000);
+    }
+    resumes = 0;
+    migrations = 0;
+    uint64_t steals = 0;
+    for(auto& i : sc.getThreadStats()) {
+        resumes += i.resumes;
+        migrations += i.migrations;
+        steals += i.steals;
+    }
+    SYLAR_LOG_INFO(g_logger) << "affinity prefer_last resumes=" << resumes
+        << " migrations=" << migrations << " steals=" << steals;
+    sc.stop();
+}
+
 int main(int argc, char* argv[]) {
     YAML::Node root = YAML::LoadFile("../bin/conf/log.yml");
     sylar::Config::LoadFromYaml(root);
@@ -39,6 +508,12 @@ int main(int argc, char* argv[]) {
      * 1是携程调度器所在，2是start的idle，3是执行test任务的协程
      */
     SYLAR_LOG_INFO(g_logger) << "main start";
+    test_fiber_mutex();
+    test_channel();
+    test_coroutine_task();
+    test_future();
+    test_cancellation();
+    test_affinity();
 
     sylar::Scheduler sc(2, true, "sheduler");
     // start()后，由调度协程进行任务分派，主协程需要等调度协程结束才能回来
@@ -51,8 +526,20 @@ int main(int argc, char* argv[]) {
     // }, "add");
     // thread.join();
     sc.schedule(test_fiber);
+    // 回调只需可移动：捕获 unique_ptr 的 lambda 也能调度，且放在内联存储里不分配堆内存
+    auto value = std::make_unique<int>(42);
+    sc.schedule([v = std::move(value)]() {
+        SYLAR_LOG_INFO(g_logger) << "move only task value=" << *v;
+    });
+    sc.schedule(&test_handoff);
+    // 会 yield 的回调任务：结束后协程回到池中，后面的任务不再新建协程
+    for(int i = 0; i < 20; ++i) {
+        sc.schedule(&test_yield_task);
+    }
     sc.stop();
 
+    SYLAR_LOG_INFO(g_logger) << "fibers created=" << sc.getFibersCreated()
+        << " reused=" << sc.getFibersReused();
     SYLAR_LOG_INFO(g_logger) << "main end";
     return 0;
 }
\ No newline at end of file